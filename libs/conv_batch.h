@@ -0,0 +1,378 @@
+/*
+
+SPDX-License-Identifier: MIT
+
+
+Batch mode for the asset conversion tools (qoiconv, qoaconv)
+
+Converts all files with certain extensions in a directory tree into a mirrored
+output tree, on a number of threads. Inputs that did not change since the last
+run are skipped: a cache manifest in the output directory stores a hash of
+each input file's contents.
+
+Define CONV_BATCH_IMPLEMENTATION in one C file before including this header.
+Link with -lpthread on non-Windows platforms.
+
+*/
+
+#ifndef CONV_BATCH_H
+#define CONV_BATCH_H
+
+// Convert the file at in_path to out_path. Return 0 on failure. This is called
+// from multiple threads at once.
+typedef int (*conv_batch_func_t)(const char *in_path, const char *out_path);
+
+// Convert all files in the tree in_dir that end with one of the NULL
+// terminated in_exts to the same relative path in out_dir, with the extension
+// replaced by out_ext. The manifest is stored as out_dir/cache_name. Uses
+// threads threads, or the number of CPUs if threads is 0. Returns the number
+// of failed conversions.
+int conv_batch(
+	const char *in_dir, const char **in_exts, const char *out_dir,
+	const char *out_ext, const char *cache_name, int threads,
+	conv_batch_func_t convert
+);
+
+#endif
+
+
+#ifdef CONV_BATCH_IMPLEMENTATION
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define CONV_BATCH_MAX_PATH 1024
+
+#if defined(_WIN32)
+	#include <windows.h>
+	#include <direct.h>
+	#define conv_batch_mkdir(PATH) _mkdir(PATH)
+#else
+	#include <dirent.h>
+	#include <pthread.h>
+	#include <unistd.h>
+	#define conv_batch_mkdir(PATH) mkdir(PATH, 0755)
+#endif
+
+typedef struct {
+	char *in_path;
+	char *out_path;
+	char *rel_path;
+	unsigned long long hash;
+	unsigned long long cached_hash;
+	int status; // 0 = failed, 1 = converted, 2 = skipped
+} conv_batch_job_t;
+
+typedef struct {
+	conv_batch_job_t *jobs;
+	int len;
+	int capacity;
+	int next;
+	conv_batch_func_t convert;
+} conv_batch_t;
+
+
+// Same hash function as used by QOP archives, but over the file contents
+static int conv_batch_hash_file(const char *path, unsigned long long *hash) {
+	FILE *fh = fopen(path, "rb");
+	if (!fh) {
+		return 0;
+	}
+
+	unsigned long long h = 525201411107845655ull;
+	unsigned char buffer[64 * 1024];
+	size_t bytes_read;
+	while ((bytes_read = fread(buffer, 1, sizeof(buffer), fh)) > 0) {
+		for (size_t i = 0; i < bytes_read; i++) {
+			h ^= buffer[i];
+			h *= 0x5bd1e9955bd1e995ull;
+			h ^= h >> 47;
+		}
+	}
+	fclose(fh);
+	*hash = h;
+	return 1;
+}
+
+static int conv_batch_file_exists(const char *path) {
+	struct stat s;
+	return stat(path, &s) == 0;
+}
+
+// Create all directories leading up to the file at path
+static void conv_batch_create_dirs(const char *path) {
+	char tmp[CONV_BATCH_MAX_PATH];
+	snprintf(tmp, sizeof(tmp), "%s", path);
+	for (char *p = tmp + 1; *p; p++) {
+		if (*p == '/') {
+			*p = '\0';
+			if (!conv_batch_file_exists(tmp)) {
+				conv_batch_mkdir(tmp);
+			}
+			*p = '/';
+		}
+	}
+}
+
+static int conv_batch_has_ext(const char *name, const char **exts) {
+	size_t name_len = strlen(name);
+	for (int i = 0; exts[i]; i++) {
+		size_t ext_len = strlen(exts[i]);
+		if (name_len > ext_len && strcmp(name + name_len - ext_len, exts[i]) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void conv_batch_add(
+	conv_batch_t *batch, const char *in_dir, const char *rel_path,
+	const char *out_dir, const char *out_ext
+) {
+	char in_path[CONV_BATCH_MAX_PATH];
+	char out_path[CONV_BATCH_MAX_PATH];
+	int in_len = snprintf(in_path, sizeof(in_path), "%s/%s", in_dir, rel_path);
+	int out_len = snprintf(out_path, sizeof(out_path), "%s/%s", out_dir, rel_path);
+	char *ext = strrchr(out_path, '.');
+	if (
+		in_len < 0 || in_len >= (int)sizeof(in_path) ||
+		out_len < 0 || out_len >= (int)sizeof(out_path) || !ext ||
+		(ext - out_path) + strlen(out_ext) >= sizeof(out_path)
+	) {
+		printf("Path too long, skipping %s/%s\n", in_dir, rel_path);
+		return;
+	}
+	strcpy(ext, out_ext);
+
+	if (batch->len >= batch->capacity) {
+		batch->capacity = batch->capacity ? batch->capacity * 2 : 256;
+		batch->jobs = realloc(batch->jobs, batch->capacity * sizeof(conv_batch_job_t));
+	}
+
+	conv_batch_job_t *job = &batch->jobs[batch->len++];
+	memset(job, 0, sizeof(conv_batch_job_t));
+	job->rel_path = strdup(rel_path);
+	job->in_path = strdup(in_path);
+	job->out_path = strdup(out_path);
+}
+
+// Collect all matching files in in_dir/rel_dir
+static void conv_batch_collect(
+	conv_batch_t *batch, const char *in_dir, const char *rel_dir,
+	const char **in_exts, const char *out_dir, const char *out_ext
+) {
+	char dir_path[CONV_BATCH_MAX_PATH];
+	char rel_path[CONV_BATCH_MAX_PATH];
+	int dir_len = snprintf(dir_path, sizeof(dir_path), rel_dir[0] ? "%s/%s" : "%s", in_dir, rel_dir);
+	if (dir_len < 0 || dir_len >= (int)sizeof(dir_path)) {
+		printf("Path too long, skipping %s/%s\n", in_dir, rel_dir);
+		return;
+	}
+
+	#if defined(_WIN32)
+		char find_str[CONV_BATCH_MAX_PATH];
+		snprintf(find_str, sizeof(find_str), "%s/*", dir_path);
+		WIN32_FIND_DATA data;
+		HANDLE dir = FindFirstFile(find_str, &data);
+		if (dir == INVALID_HANDLE_VALUE) {
+			return;
+		}
+		do {
+			char *name = data.cFileName;
+			int is_dir = data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY;
+	#else
+		DIR *dir = opendir(dir_path);
+		if (!dir) {
+			return;
+		}
+		struct dirent *entry;
+		while ((entry = readdir(dir))) {
+			char *name = entry->d_name;
+			int is_dir = entry->d_type == DT_DIR;
+	#endif
+
+			if (name[0] == '.') {
+				continue;
+			}
+			int rel_len = snprintf(rel_path, sizeof(rel_path), rel_dir[0] ? "%s/%s" : "%s%s", rel_dir, name);
+			if (rel_len < 0 || rel_len >= (int)sizeof(rel_path)) {
+				printf("Path too long, skipping %s/%s/%s\n", in_dir, rel_dir, name);
+				continue;
+			}
+
+			// Not all file systems report the type of an entry
+			#if !defined(_WIN32)
+				if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+					char entry_path[CONV_BATCH_MAX_PATH];
+					struct stat s;
+					int entry_len = snprintf(entry_path, sizeof(entry_path), "%s/%s", dir_path, name);
+					is_dir = (
+						entry_len > 0 && entry_len < (int)sizeof(entry_path) &&
+						stat(entry_path, &s) == 0 && S_ISDIR(s.st_mode)
+					);
+				}
+			#endif
+			if (is_dir) {
+				conv_batch_collect(batch, in_dir, rel_path, in_exts, out_dir, out_ext);
+			}
+			else if (conv_batch_has_ext(name, in_exts)) {
+				conv_batch_add(batch, in_dir, rel_path, out_dir, out_ext);
+			}
+
+	#if defined(_WIN32)
+		} while (FindNextFile(dir, &data));
+		FindClose(dir);
+	#else
+		}
+		closedir(dir);
+	#endif
+}
+
+static void conv_batch_manifest_read(conv_batch_t *batch, const char *path) {
+	FILE *fh = fopen(path, "r");
+	if (!fh) {
+		return;
+	}
+
+	unsigned long long hash;
+	char rel_path[CONV_BATCH_MAX_PATH];
+	while (fscanf(fh, "%llx %1023[^\n]\n", &hash, rel_path) == 2) {
+		for (int i = 0; i < batch->len; i++) {
+			if (strcmp(batch->jobs[i].rel_path, rel_path) == 0) {
+				batch->jobs[i].cached_hash = hash;
+				break;
+			}
+		}
+	}
+	fclose(fh);
+}
+
+static void conv_batch_manifest_write(conv_batch_t *batch, const char *path) {
+	conv_batch_create_dirs(path);
+	FILE *fh = fopen(path, "w");
+	if (!fh) {
+		printf("Couldn't write cache manifest %s\n", path);
+		return;
+	}
+
+	for (int i = 0; i < batch->len; i++) {
+		if (batch->jobs[i].status) {
+			fprintf(fh, "%016llx %s\n", batch->jobs[i].hash, batch->jobs[i].rel_path);
+		}
+	}
+	fclose(fh);
+}
+
+static void conv_batch_process(conv_batch_job_t *job, conv_batch_func_t convert) {
+	if (!conv_batch_hash_file(job->in_path, &job->hash)) {
+		printf("Couldn't read %s\n", job->in_path);
+		return;
+	}
+
+	if (job->hash == job->cached_hash && conv_batch_file_exists(job->out_path)) {
+		job->status = 2;
+		return;
+	}
+
+	conv_batch_create_dirs(job->out_path);
+	job->status = convert(job->in_path, job->out_path) ? 1 : 0;
+	if (!job->status) {
+		printf("Couldn't convert %s\n", job->in_path);
+	}
+}
+
+#if defined(_WIN32)
+	static DWORD WINAPI conv_batch_thread(LPVOID data) {
+#else
+	static void *conv_batch_thread(void *data) {
+#endif
+	conv_batch_t *batch = data;
+	int index;
+	while ((index = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) < batch->len) {
+		conv_batch_process(&batch->jobs[index], batch->convert);
+	}
+	return 0;
+}
+
+int conv_batch(
+	const char *in_dir, const char **in_exts, const char *out_dir,
+	const char *out_ext, const char *cache_name, int threads,
+	conv_batch_func_t convert
+) {
+	conv_batch_t batch = {.convert = convert};
+	conv_batch_collect(&batch, in_dir, "", in_exts, out_dir, out_ext);
+
+	char manifest_path[CONV_BATCH_MAX_PATH];
+	snprintf(manifest_path, sizeof(manifest_path), "%s/%s", out_dir, cache_name);
+	conv_batch_manifest_read(&batch, manifest_path);
+
+	if (threads <= 0) {
+		#if defined(_WIN32)
+			SYSTEM_INFO info;
+			GetSystemInfo(&info);
+			threads = info.dwNumberOfProcessors;
+		#else
+			threads = sysconf(_SC_NPROCESSORS_ONLN);
+		#endif
+	}
+	if (threads > batch.len) {
+		threads = batch.len;
+	}
+
+	// Run the jobs on threads-1 extra threads and this one. If a thread can't
+	// be created, the others (or just this one) still drain the queue.
+	int created = 0;
+	#if defined(_WIN32)
+		HANDLE *handles = malloc(sizeof(HANDLE) * (threads + 1));
+		for (int i = 1; i < threads; i++) {
+			HANDLE h = CreateThread(NULL, 0, conv_batch_thread, &batch, 0, NULL);
+			if (h) {
+				handles[created++] = h;
+			}
+		}
+		conv_batch_thread(&batch);
+		for (int i = 0; i < created; i++) {
+			WaitForSingleObject(handles[i], INFINITE);
+			CloseHandle(handles[i]);
+		}
+	#else
+		pthread_t *handles = malloc(sizeof(pthread_t) * (threads + 1));
+		for (int i = 1; i < threads; i++) {
+			if (pthread_create(&handles[created], NULL, conv_batch_thread, &batch) == 0) {
+				created++;
+			}
+		}
+		conv_batch_thread(&batch);
+		for (int i = 0; i < created; i++) {
+			pthread_join(handles[i], NULL);
+		}
+	#endif
+	if (created < threads - 1) {
+		printf("Failed to create %d of %d threads\n", threads - 1 - created, threads - 1);
+		threads = created + 1;
+	}
+	free(handles);
+
+	conv_batch_manifest_write(&batch, manifest_path);
+
+	int converted = 0, skipped = 0, failed = 0;
+	for (int i = 0; i < batch.len; i++) {
+		converted += batch.jobs[i].status == 1;
+		skipped += batch.jobs[i].status == 2;
+		failed += batch.jobs[i].status == 0;
+		free(batch.jobs[i].in_path);
+		free(batch.jobs[i].out_path);
+		free(batch.jobs[i].rel_path);
+	}
+	free(batch.jobs);
+
+	printf(
+		"%s: %d converted, %d unchanged, %d failed (%d threads)\n",
+		in_dir, converted, skipped, failed, threads
+	);
+	return failed;
+}
+
+#endif // CONV_BATCH_IMPLEMENTATION
@@ -0,0 +1,397 @@
+/*
+
+SPDX-License-Identifier: MIT
+
+
+Command line tool to convert Weltmeister json levels into the binary level 
+format described in src/level.h
+
+Requires:
+	-"pl_json.h" (https://github.com/phoboslab/pl_json)
+
+Compile with: 
+	gcc levelconv.c -std=gnu99 -O3 -o levelconv
+
+*/
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PL_JSON_IMPLEMENTATION
+#include "pl_json.h"
+#include "../src/level.h"
+
+#define STRINGIFY(x) #x
+#define TOSTRING(x) STRINGIFY(x)
+#define die(...) \
+	printf("Abort at " TOSTRING(__FILE__) " line " TOSTRING(__LINE__) ": " __VA_ARGS__); \
+	printf("\n"); \
+	exit(1)
+
+#define error_if(TEST, ...) \
+	if (TEST) { \
+		die(__VA_ARGS__); \
+	}
+
+
+// -----------------------------------------------------------------------------
+// A growable byte buffer
+
+typedef struct {
+	unsigned char *data;
+	unsigned int len;
+	unsigned int capacity;
+} buffer_t;
+
+void buffer_write(buffer_t *b, const void *data, unsigned int len) {
+	if (b->len + len > b->capacity) {
+		b->capacity = (b->len + len) * 2;
+		b->data = realloc(b->data, b->capacity);
+		error_if(!b->data, "Out of memory");
+	}
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+}
+
+void buffer_align(buffer_t *b, unsigned int align) {
+	unsigned long long zero = 0;
+	buffer_write(b, &zero, (align - (b->len & (align - 1))) & (align - 1));
+}
+
+void buffer_printf(buffer_t *b, const char *format, ...) {
+	char tmp[64];
+	va_list args;
+	va_start(args, format);
+	int len = vsnprintf(tmp, sizeof(tmp), format, args);
+	va_end(args);
+	buffer_write(b, tmp, len);
+}
+
+
+// -----------------------------------------------------------------------------
+// String table
+
+buffer_t strings;
+
+unsigned int string_add(const char *str) {
+	if (!str || !str[0]) {
+		return 0;
+	}
+
+	// Reuse existing strings
+	for (unsigned int i = 1; i < strings.len; i += strlen((char *)strings.data + i) + 1) {
+		if (strcmp((char *)strings.data + i, str) == 0) {
+			return i;
+		}
+	}
+
+	unsigned int offset = strings.len;
+	buffer_write(&strings, str, strlen(str) + 1);
+	return offset;
+}
+
+
+
+// -----------------------------------------------------------------------------
+// Compact json writer for entity settings
+
+void json_write(buffer_t *b, json_t *v) {
+	switch (v->type) {
+		case JSON_NULL: buffer_write(b, "null", 4); break;
+		case JSON_TRUE: buffer_write(b, "true", 4); break;
+		case JSON_FALSE: buffer_write(b, "false", 5); break;
+		case JSON_NUMBER: buffer_printf(b, "%.17g", v->number); break;
+		case JSON_STRING: {
+			buffer_write(b, "\"", 1);
+			for (char *c = v->string; *c; c++) {
+				switch (*c) {
+					case '"':  buffer_write(b, "\\\"", 2); break;
+					case '\\': buffer_write(b, "\\\\", 2); break;
+					case '\n': buffer_write(b, "\\n", 2); break;
+					case '\r': buffer_write(b, "\\r", 2); break;
+					case '\t': buffer_write(b, "\\t", 2); break;
+					default: buffer_write(b, c, 1);
+				}
+			}
+			buffer_write(b, "\"", 1);
+			break;
+		}
+		case JSON_ARRAY: {
+			buffer_write(b, "[", 1);
+			for (unsigned int i = 0; i < v->len; i++) {
+				if (i > 0) {
+					buffer_write(b, ",", 1);
+				}
+				json_write(b, json_value_at(v, i));
+			}
+			buffer_write(b, "]", 1);
+			break;
+		}
+		case JSON_OBJECT: {
+			buffer_write(b, "{", 1);
+			for (unsigned int i = 0; i < v->len; i++) {
+				if (i > 0) {
+					buffer_write(b, ",", 1);
+				}
+				json_t key = {.type = JSON_STRING, .string = json_keys(v)[i]};
+				json_write(b, &key);
+				buffer_write(b, ":", 1);
+				json_write(b, json_value_at(v, i));
+			}
+			buffer_write(b, "}", 1);
+			break;
+		}
+	}
+}
+
+
+// -----------------------------------------------------------------------------
+// Entity settings blobs, see entity_settings_t in src/level.h
+
+// Must be the same as str_hash() in src/utils.c
+unsigned long long str_hash(const char *str) {
+	unsigned long long h = 525201411107845655ull;
+	for (; *str; str++) {
+		h ^= (unsigned char)*str;
+		h *= 0x5bd1e9955bd1e995ull;
+		h ^= h >> 47;
+	}
+	return h;
+}
+
+void settings_write(buffer_t *b, json_t *def) {
+	unsigned int capacity = 2;
+	while (capacity < def->len * 2) {
+		capacity *= 2;
+	}
+
+	entity_setting_t *slots = malloc(capacity * sizeof(entity_setting_t));
+	for (unsigned int i = 0; i < capacity; i++) {
+		slots[i] = (entity_setting_t){.type = LEVEL_SETTING_EMPTY};
+	}
+
+	unsigned int data_start = sizeof(struct entity_settings_t) + capacity * sizeof(entity_setting_t);
+	buffer_t data = {0};
+	for (unsigned int i = 0; i < def->len; i++) {
+		unsigned long long hash = str_hash(json_keys(def)[i]);
+		unsigned int slot = hash & (capacity - 1);
+		while (slots[slot].type != LEVEL_SETTING_EMPTY && slots[slot].hash != hash) {
+			slot = (slot + 1) & (capacity - 1);
+		}
+
+		// Keep the first of duplicate keys, same as json_value_for_key()
+		if (slots[slot].type != LEVEL_SETTING_EMPTY) {
+			continue;
+		}
+
+		json_t *v = json_value_at(def, i);
+		slots[slot].hash = hash;
+		slots[slot].type = v->type;
+		if (v->type == JSON_NUMBER) {
+			slots[slot].number = v->number;
+		}
+		else if (v->type == JSON_STRING) {
+			slots[slot].offset = data_start + data.len;
+			buffer_write(&data, v->string, strlen(v->string) + 1);
+		}
+		else if (v->type == JSON_ARRAY || v->type == JSON_OBJECT) {
+			slots[slot].offset = data_start + data.len;
+			json_write(&data, v);
+			buffer_write(&data, "", 1);
+		}
+	}
+
+	struct entity_settings_t header = {.size = data_start + data.len, .capacity = capacity};
+	buffer_write(b, &header, sizeof(header));
+	buffer_write(b, slots, capacity * sizeof(entity_setting_t));
+	buffer_write(b, data.data, data.len);
+	buffer_align(b, 8);
+
+	free(slots);
+	free(data.data);
+}
+
+
+// -----------------------------------------------------------------------------
+// Conversion
+
+json_t *json_load(const char *path) {
+	FILE *fh = fopen(path, "rb");
+	error_if(!fh, "Couldn't open %s", path);
+	fseek(fh, 0, SEEK_END);
+	int size = ftell(fh);
+	fseek(fh, 0, SEEK_SET);
+
+	char *text = malloc(size);
+	error_if(fread(text, 1, size, fh) != size, "Couldn't read %s", path);
+	fclose(fh);
+
+	unsigned int tokens_capacity = 1 + size / 2;
+	json_token_t *tokens = malloc(tokens_capacity * sizeof(json_token_t));
+	unsigned int size_req = 0;
+	int tokens_len = json_tokenize(text, size, tokens, tokens_capacity, &size_req);
+	error_if(tokens_len <= 0, "Couldn't parse %s", path);
+
+	json_t *v = malloc(size_req);
+	json_parse_tokens(text, tokens, tokens_len, v);
+	free(tokens);
+	free(text);
+	return v;
+}
+
+int level_convert(const char *json_path, const char *out_path) {
+	json_t *level = json_load(json_path);
+	json_t *maps = json_value_for_key(level, "maps");
+	json_t *entities = json_value_for_key(level, "entities");
+	unsigned int maps_len = maps ? maps->len : 0;
+	unsigned int entities_len = entities ? entities->len : 0;
+
+	strings = (buffer_t){0};
+	buffer_write(&strings, "", 1);
+
+	// Maps and their tiles
+	level_map_t *map_defs = calloc(maps_len, sizeof(level_map_t));
+	buffer_t tiles = {0};
+	unsigned int *tiles_offsets = calloc(maps_len, sizeof(unsigned int));
+
+	for (unsigned int i = 0; i < maps_len; i++) {
+		json_t *map = json_value_at(maps, i);
+		level_map_t *def = &map_defs[i];
+		def->name = string_add(json_string(json_value_for_key(map, "name")));
+		def->tileset_name = string_add(json_string(json_value_for_key(map, "tilesetName")));
+		def->width = json_number(json_value_for_key(map, "width"));
+		def->height = json_number(json_value_for_key(map, "height"));
+		def->tile_size = json_number(json_value_for_key(map, "tilesize"));
+		def->distance = json_number(json_value_for_key(map, "distance"));
+		def->repeat = json_bool(json_value_for_key(map, "repeat"));
+		def->foreground = json_bool(json_value_for_key(map, "foreground"));
+
+		json_t *data = json_value_for_key(map, "data");
+		error_if(!data || data->type != JSON_ARRAY || data->len != def->height, "Map %d data height is not %d", i, def->height);
+
+		tiles_offsets[i] = tiles.len;
+		for (unsigned int y = 0; y < data->len; y++) {
+			json_t *row = json_value_at(data, y);
+			error_if(row->type != JSON_ARRAY || row->len != def->width, "Map %d row %d width is not %d", i, y, def->width);
+			for (unsigned int x = 0; x < row->len; x++) {
+				unsigned short tile = json_number(json_value_at(row, x));
+				if (tile > def->max_tile) {
+					def->max_tile = tile;
+				}
+				buffer_write(&tiles, &tile, sizeof(tile));
+			}
+		}
+		buffer_align(&tiles, 4);
+	}
+
+	// Entities; types are collected by name
+	level_entity_t *entity_defs = calloc(entities_len, sizeof(level_entity_t));
+	unsigned int *type_names = calloc(entities_len, sizeof(unsigned int));
+	unsigned int types_len = 0;
+	buffer_t settings_blobs = {0};
+	unsigned int *settings_offsets = calloc(entities_len, sizeof(unsigned int));
+
+	for (unsigned int i = 0; i < entities_len; i++) {
+		json_t *ent = json_value_at(entities, i);
+		level_entity_t *def = &entity_defs[i];
+
+		char *type_name = json_string(json_value_for_key(ent, "type"));
+		error_if(!type_name, "Entity %d has no type", i);
+		unsigned int type_string = string_add(type_name);
+		for (def->type = 0; def->type < types_len && type_names[def->type] != type_string; def->type++) {}
+		if (def->type == types_len) {
+			type_names[types_len++] = type_string;
+		}
+
+		def->x = json_number(json_value_for_key(ent, "x"));
+		def->y = json_number(json_value_for_key(ent, "y"));
+
+		json_t *settings = json_value_for_key(ent, "settings");
+		if (settings && settings->type == JSON_OBJECT) {
+			// Offsets are relative to the settings section for now, with +1 
+			// to tell them apart from entities without settings
+			settings_offsets[i] = settings_blobs.len + 1;
+			settings_write(&settings_blobs, settings);
+		}
+	}
+
+	// Lay out the file: header, strings, maps, tiles, types, entities, settings
+	level_header_t header = {.magic = LEVEL_MAGIC, .version = LEVEL_VERSION};
+	unsigned int pos = sizeof(level_header_t);
+
+	header.strings_offset = pos;
+	header.strings_size = strings.len;
+	pos += (strings.len + 3) & ~3;
+
+	header.maps_offset = pos;
+	header.maps_len = maps_len;
+	pos += maps_len * sizeof(level_map_t);
+
+	for (unsigned int i = 0; i < maps_len; i++) {
+		map_defs[i].data_offset = pos + tiles_offsets[i];
+	}
+	pos += tiles.len;
+
+	header.types_offset = pos;
+	header.types_len = types_len;
+	pos += types_len * sizeof(unsigned int);
+
+	header.entities_offset = pos;
+	header.entities_len = entities_len;
+	pos += entities_len * sizeof(level_entity_t);
+
+	header.settings_offset = (pos + 7) & ~7;
+	header.settings_size = settings_blobs.len;
+	for (unsigned int i = 0; i < entities_len; i++) {
+		if (settings_offsets[i]) {
+			entity_defs[i].settings = header.settings_offset + settings_offsets[i] - 1;
+		}
+	}
+
+	buffer_t out = {0};
+	buffer_write(&out, &header, sizeof(header));
+	buffer_write(&out, strings.data, strings.len);
+	buffer_align(&out, 4);
+	buffer_write(&out, map_defs, maps_len * sizeof(level_map_t));
+	buffer_write(&out, tiles.data, tiles.len);
+	buffer_write(&out, type_names, types_len * sizeof(unsigned int));
+	buffer_write(&out, entity_defs, entities_len * sizeof(level_entity_t));
+	buffer_align(&out, 8);
+	buffer_write(&out, settings_blobs.data, settings_blobs.len);
+
+	FILE *fh = fopen(out_path, "wb");
+	error_if(!fh, "Couldn't open %s for writing", out_path);
+	error_if(fwrite(out.data, 1, out.len, fh) != out.len, "Couldn't write %s", out_path);
+	fclose(fh);
+
+	printf(
+		"%s: %d maps, %d entities (%d types), %d bytes\n", 
+		out_path, maps_len, entities_len, types_len, out.len
+	);
+
+	free(out.data);
+	free(tiles.data);
+	free(strings.data);
+	free(map_defs);
+	free(tiles_offsets);
+	free(entity_defs);
+	free(type_names);
+	free(settings_blobs.data);
+	free(settings_offsets);
+	free(level);
+	return out.len;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 3) {
+		puts("Usage: levelconv <infile.json> <outfile>");
+		puts("Examples:");
+		puts("  levelconv assets/levels/biolab1.json assets/levels/biolab1.lvl");
+		exit(1);
+	}
+
+	level_convert(argv[1], argv[2]);
+	return 0;
+}
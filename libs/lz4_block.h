@@ -0,0 +1,258 @@
+/*
+
+SPDX-License-Identifier: MIT
+
+
+A minimal compressor and decompressor for the LZ4 block format
+
+The compressor is a simple greedy matcher with a single hash table; it favors
+a small footprint over the best ratio. The decompressor is bounds checked and
+copies in 8 byte steps where it can.
+
+Define `LZ4_BLOCK_IMPLEMENTATION` in *one* C/C++ file before including this
+library to create the implementation.
+
+Block format (see https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md)
+is a sequence of:
+	- token: 4 bits literal length, 4 bits match length - 4; each 15 is
+	  followed by additional length bytes, added up until one is < 255
+	- literals
+	- 16 bit little endian match offset, 1..65535
+The last sequence only has literals; the last 5 bytes are always literals.
+
+*/
+
+#ifndef LZ4_BLOCK_H
+#define LZ4_BLOCK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The max size of the compressed data for src_len bytes of input
+#define LZ4_BLOCK_COMPRESS_BOUND(src_len) ((src_len) + (src_len) / 255 + 16)
+
+// Compress src_len bytes from src into dst with a capacity of dst_cap bytes.
+// Returns the compressed size or 0 if it doesn't fit.
+int lz4_block_compress(const unsigned char *src, int src_len, unsigned char *dst, int dst_cap);
+
+// Decompress src_len bytes from src into dst with a capacity of dst_cap bytes.
+// Returns the decompressed size or -1 if the data is malformed or doesn't fit.
+int lz4_block_decompress(const unsigned char *src, int src_len, unsigned char *dst, int dst_cap);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* LZ4_BLOCK_H */
+
+
+
+/* -----------------------------------------------------------------------------
+Implementation */
+
+#ifdef LZ4_BLOCK_IMPLEMENTATION
+
+#include <string.h>
+
+#define LZ4_BLOCK_HASH_BITS 12
+#define LZ4_BLOCK_MIN_MATCH 4
+#define LZ4_BLOCK_LAST_LITERALS 5
+#define LZ4_BLOCK_MF_LIMIT 12
+#define LZ4_BLOCK_MAX_OFFSET 65535
+
+static unsigned int lz4_block_read_32(const unsigned char *p) {
+	unsigned int v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static unsigned int lz4_block_hash(unsigned int v) {
+	return (v * 2654435761u) >> (32 - LZ4_BLOCK_HASH_BITS);
+}
+
+static unsigned char *lz4_block_write_len(unsigned char *op, unsigned char *oend, int len) {
+	for (; len >= 255; len -= 255) {
+		if (op >= oend) {
+			return NULL;
+		}
+		*op++ = 255;
+	}
+	if (op >= oend) {
+		return NULL;
+	}
+	*op++ = len;
+	return op;
+}
+
+// Write one sequence; match_len = 0 for the last literals
+static unsigned char *lz4_block_write_sequence(
+	unsigned char *op, unsigned char *oend, const unsigned char *literals,
+	int literals_len, int offset, int match_len
+) {
+	if (op >= oend) {
+		return NULL;
+	}
+	unsigned char *token = op++;
+	*token = (literals_len >= 15 ? 15 : literals_len) << 4;
+	if (literals_len >= 15 && !(op = lz4_block_write_len(op, oend, literals_len - 15))) {
+		return NULL;
+	}
+
+	if (oend - op < literals_len) {
+		return NULL;
+	}
+	memcpy(op, literals, literals_len);
+	op += literals_len;
+
+	if (match_len) {
+		if (oend - op < 2) {
+			return NULL;
+		}
+		*op++ = offset & 0xff;
+		*op++ = offset >> 8;
+
+		match_len -= LZ4_BLOCK_MIN_MATCH;
+		*token |= match_len >= 15 ? 15 : match_len;
+		if (match_len >= 15 && !(op = lz4_block_write_len(op, oend, match_len - 15))) {
+			return NULL;
+		}
+	}
+	return op;
+}
+
+int lz4_block_compress(const unsigned char *src, int src_len, unsigned char *dst, int dst_cap) {
+	// Positions + 1 of the last occurrence of each hashed 4 byte sequence
+	unsigned int table[1 << LZ4_BLOCK_HASH_BITS];
+	memset(table, 0, sizeof(table));
+
+	const unsigned char *ip = src;
+	const unsigned char *anchor = src;
+	const unsigned char *iend = src + src_len;
+	unsigned char *op = dst;
+	unsigned char *oend = dst + dst_cap;
+
+	if (src_len > LZ4_BLOCK_MF_LIMIT) {
+		const unsigned char *mflimit = iend - LZ4_BLOCK_MF_LIMIT;
+		const unsigned char *matchlimit = iend - LZ4_BLOCK_LAST_LITERALS;
+
+		while (ip < mflimit) {
+			unsigned int seq = lz4_block_read_32(ip);
+			unsigned int h = lz4_block_hash(seq);
+			unsigned int ref_pos = table[h];
+			table[h] = (ip - src) + 1;
+
+			const unsigned char *ref = src + ref_pos - 1;
+			if (
+				ref_pos == 0 || ip - ref > LZ4_BLOCK_MAX_OFFSET ||
+				lz4_block_read_32(ref) != seq
+			) {
+				ip++;
+				continue;
+			}
+
+			// Extend the match backwards into pending literals and forwards
+			while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+				ip--;
+				ref--;
+			}
+			const unsigned char *match_end = ip + LZ4_BLOCK_MIN_MATCH;
+			const unsigned char *ref_end = ref + LZ4_BLOCK_MIN_MATCH;
+			while (match_end < matchlimit && *match_end == *ref_end) {
+				match_end++;
+				ref_end++;
+			}
+
+			op = lz4_block_write_sequence(op, oend, anchor, ip - anchor, ip - ref, match_end - ip);
+			if (!op) {
+				return 0;
+			}
+			ip = match_end;
+			anchor = ip;
+		}
+	}
+
+	op = lz4_block_write_sequence(op, oend, anchor, iend - anchor, 0, 0);
+	return op ? op - dst : 0;
+}
+
+int lz4_block_decompress(const unsigned char *src, int src_len, unsigned char *dst, int dst_cap) {
+	const unsigned char *ip = src;
+	const unsigned char *iend = src + src_len;
+	unsigned char *op = dst;
+	unsigned char *oend = dst + dst_cap;
+
+	while (ip < iend) {
+		unsigned int token = *ip++;
+
+		// Literals
+		unsigned int literals_len = token >> 4;
+		if (literals_len == 15) {
+			unsigned int b;
+			do {
+				if (ip >= iend) {
+					return -1;
+				}
+				b = *ip++;
+				literals_len += b;
+			} while (b == 255);
+		}
+		if (literals_len > (unsigned int)(iend - ip) || literals_len > (unsigned int)(oend - op)) {
+			return -1;
+		}
+		memcpy(op, ip, literals_len);
+		op += literals_len;
+		ip += literals_len;
+
+		// The last sequence has no match
+		if (ip >= iend) {
+			break;
+		}
+
+		// Match
+		if (iend - ip < 2) {
+			return -1;
+		}
+		unsigned int offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > (unsigned int)(op - dst)) {
+			return -1;
+		}
+
+		unsigned int match_len = token & 15;
+		if (match_len == 15) {
+			unsigned int b;
+			do {
+				if (ip >= iend) {
+					return -1;
+				}
+				b = *ip++;
+				match_len += b;
+			} while (b == 255);
+		}
+		match_len += LZ4_BLOCK_MIN_MATCH;
+		if (match_len > (unsigned int)(oend - op)) {
+			return -1;
+		}
+
+		// Copy 8 bytes at a time if the match doesn't overlap within those 8
+		// bytes and we have room to overshoot; byte by byte otherwise.
+		const unsigned char *match = op - offset;
+		unsigned char *match_end = op + match_len;
+		if (offset >= 8 && oend - match_end >= 8) {
+			while (op < match_end) {
+				memcpy(op, match, 8);
+				op += 8;
+				match += 8;
+			}
+			op = match_end;
+		}
+		else {
+			while (op < match_end) {
+				*op++ = *match++;
+			}
+		}
+	}
+	return op - dst;
+}
+
+#endif /* LZ4_BLOCK_IMPLEMENTATION */
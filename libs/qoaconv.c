@@ -10,8 +10,10 @@ Define QOACONV_HAS_DRMP3 and QOACONV_HAS_DRFLAC for MP3 and FLAC support
  -"dr_mp3.h" (https://github.com/mackron/dr_libs/blob/master/dr_mp3.h)
  -"dr_flac.h" (https://github.com/mackron/dr_libs/blob/master/dr_flac.h)
 
+Batch mode (-r) requires "conv_batch.h"
+
 Compile with: 
-	gcc qoaconv.c -std=gnu99 -lm -O3 -o qoaconv
+	gcc qoaconv.c -std=gnu99 -lm -lpthread -O3 -o qoaconv
 
 */
 
@@ -36,6 +38,9 @@ Compile with:
 #define QOA_RECORD_TOTAL_ERROR
 #include "qoa.h"
 
+#define CONV_BATCH_IMPLEMENTATION
+#include "conv_batch.h"
+
 #define QOACONV_STRINGIFY(x) #x
 #define QOACONV_TOSTRING(x) QOACONV_STRINGIFY(x)
 #define QOACONV_ABORT(...) \
@@ -47,6 +52,15 @@ Compile with:
 		QOACONV_ABORT(__VA_ARGS__); \
 	}
 
+/* The conversion itself may run on a worker thread in batch mode, so it must
+not exit(); it reports the error and returns RET instead. */
+#define QOACONV_CHECK(TEST, RET, ...) \
+	if (!(TEST)) { \
+		printf("Error: " __VA_ARGS__); \
+		printf("\n"); \
+		return RET; \
+	}
+
 #define QOACONV_STR_ENDS_WITH(S, E) (strcmp(S + strlen(S) - (sizeof(E)-1), E) == 0)
 
 
@@ -64,29 +78,33 @@ void qoaconv_fwrite_u32_le(unsigned int v, FILE *fh) {
 	buf[1] = 0xff & (v >>  8);
 	buf[2] = 0xff & (v >> 16);
 	buf[3] = 0xff & (v >> 24);
-	int wrote = fwrite(buf, sizeof(unsigned int), 1, fh);
-	QOACONV_ASSERT(wrote, "Write error");
+	fwrite(buf, sizeof(unsigned int), 1, fh);
 }
 
 void qoaconv_fwrite_u16_le(unsigned short v, FILE *fh) {
 	unsigned char buf[sizeof(unsigned short)];
 	buf[0] = 0xff & (v      );
 	buf[1] = 0xff & (v >>  8);
-	int wrote = fwrite(buf, sizeof(unsigned short), 1, fh);
-	QOACONV_ASSERT(wrote, "Write error");
+	fwrite(buf, sizeof(unsigned short), 1, fh);
 }
 
+/* The read and write helpers don't report errors themselves; callers check 
+ferror() and feof() on the file after a group of calls. A failed read returns
+0. */
+
 unsigned int qoaconv_fread_u32_le(FILE *fh) {
 	unsigned char buf[sizeof(unsigned int)];
-	int read = fread(buf, sizeof(unsigned int), 1, fh);
-	QOACONV_ASSERT(read, "Read error or unexpected end of file");
+	if (!fread(buf, sizeof(unsigned int), 1, fh)) {
+		return 0;
+	}
 	return (buf[3] << 24) | (buf[2] << 16) | (buf[1] << 8) | buf[0];
 }
 
 unsigned short qoaconv_fread_u16_le(FILE *fh) {
 	unsigned char buf[sizeof(unsigned short)];
-	int read = fread(buf, sizeof(unsigned short), 1, fh);
-	QOACONV_ASSERT(read, "Read error or unexpected end of file");
+	if (!fread(buf, sizeof(unsigned short), 1, fh)) {
+		return 0;
+	}
 	return (buf[1] << 8) | buf[0];
 }
 
@@ -99,7 +117,7 @@ int qoaconv_wav_write(const char *path, short *sample_data, qoa_desc *desc) {
 	/* Lifted from https://www.jonolick.com/code.html - public domain
 	Made endian agnostic using qoaconv_fwrite() */
 	FILE *fh = fopen(path, "wb");
-	QOACONV_ASSERT(fh, "Can't open %s for writing", path);
+	QOACONV_CHECK(fh, 0, "Can't open %s for writing", path);
 	fwrite("RIFF", 1, 4, fh);
 	qoaconv_fwrite_u32_le(data_size + 44 - 8, fh);
 	fwrite("WAVEfmt \x10\x00\x00\x00\x01\x00", 1, 14, fh);
@@ -111,20 +129,28 @@ int qoaconv_wav_write(const char *path, short *sample_data, qoa_desc *desc) {
 	fwrite("data", 1, 4, fh);
 	qoaconv_fwrite_u32_le(data_size, fh);
 	fwrite((void*)sample_data, data_size, 1, fh);
-	fclose(fh);
+	int write_error = ferror(fh);
+	int close_error = fclose(fh);
+	QOACONV_CHECK(!write_error && !close_error, 0, "Write error for %s", path);
 	return data_size  + 44 - 8;
 }
 
+#define QOACONV_WAV_CHECK(TEST, ...) \
+	if (!(TEST)) { \
+		fclose(fh); \
+		QOACONV_CHECK(0, NULL, __VA_ARGS__); \
+	}
+
 short *qoaconv_wav_read(const char *path, qoa_desc *desc) {
 	FILE *fh = fopen(path, "rb");
-	QOACONV_ASSERT(fh, "Can't open %s for reading", path);
+	QOACONV_CHECK(fh, NULL, "Can't open %s for reading", path);
 
 	unsigned int container_type = qoaconv_fread_u32_le(fh);
-	QOACONV_ASSERT(container_type == QOACONV_CHUNK_ID("RIFF"), "Not a RIFF container");
+	QOACONV_WAV_CHECK(container_type == QOACONV_CHUNK_ID("RIFF"), "Not a RIFF container: %s", path);
 
 	unsigned int wav_size = qoaconv_fread_u32_le(fh);
 	unsigned int wavid = qoaconv_fread_u32_le(fh);
-	QOACONV_ASSERT(wavid == QOACONV_CHUNK_ID("WAVE"), "No WAVE id found");
+	QOACONV_WAV_CHECK(wavid == QOACONV_CHUNK_ID("WAVE"), "No WAVE id found: %s", path);
 
 	unsigned int data_size = 0;
 	unsigned int format_length = 0;
@@ -139,9 +165,10 @@ short *qoaconv_wav_read(const char *path, qoa_desc *desc) {
 	while (1) {
 		unsigned int chunk_type = qoaconv_fread_u32_le(fh);
 		unsigned int chunk_size = qoaconv_fread_u32_le(fh);
+		QOACONV_WAV_CHECK(!feof(fh) && !ferror(fh), "Read error or unexpected end of file: %s", path);
 
 		if (chunk_type == QOACONV_CHUNK_ID("fmt ")) {
-			QOACONV_ASSERT(chunk_size == 16 || chunk_size == 18, "WAV fmt chunk size missmatch");
+			QOACONV_WAV_CHECK(chunk_size == 16 || chunk_size == 18, "WAV fmt chunk size missmatch: %s", path);
 
 			format_type = qoaconv_fread_u16_le(fh);
 			channels = qoaconv_fread_u16_le(fh);
@@ -152,8 +179,9 @@ short *qoaconv_wav_read(const char *path, qoa_desc *desc) {
 
 			if (chunk_size == 18) {
 				unsigned short extra_params = qoaconv_fread_u16_le(fh);
-				QOACONV_ASSERT(extra_params == 0, "WAV fmt extra params not supported");
+				QOACONV_WAV_CHECK(extra_params == 0, "WAV fmt extra params not supported: %s", path);
 			}
+			QOACONV_WAV_CHECK(!feof(fh) && !ferror(fh), "Read error or unexpected end of file: %s", path);
 		}
 		else if (chunk_type == QOACONV_CHUNK_ID("data")) {
 			data_size = chunk_size;
@@ -161,18 +189,22 @@ short *qoaconv_wav_read(const char *path, qoa_desc *desc) {
 		}
 		else {
 			int seek_result = fseek(fh, chunk_size, SEEK_CUR);
-			QOACONV_ASSERT(seek_result == 0, "Malformed RIFF header");
+			QOACONV_WAV_CHECK(seek_result == 0, "Malformed RIFF header: %s", path);
 		}
 	}
 
-	QOACONV_ASSERT(format_type == 1, "Type in fmt chunk is not PCM");
-	QOACONV_ASSERT(bits_per_sample == 16, "Bits per samples != 16");
-	QOACONV_ASSERT(data_size, "No data chunk");
+	QOACONV_WAV_CHECK(format_type == 1, "Type in fmt chunk is not PCM: %s", path);
+	QOACONV_WAV_CHECK(bits_per_sample == 16, "Bits per samples != 16: %s", path);
+	QOACONV_WAV_CHECK(channels > 0 && channels <= QOA_MAX_CHANNELS, "Invalid number of channels (%d): %s", channels, path);
+	QOACONV_WAV_CHECK(samplerate > 0 && samplerate <= 0xffffff, "Invalid samplerate (%d): %s", samplerate, path);
+	QOACONV_WAV_CHECK(data_size, "No data chunk: %s", path);
 
 	unsigned char *wav_bytes = malloc(data_size);
-	QOACONV_ASSERT(wav_bytes, "Malloc for %d bytes failed", data_size);
-	int read = fread(wav_bytes, data_size, 1, fh);
-	QOACONV_ASSERT(read, "Read error or unexpected end of file for %d bytes", data_size);
+	QOACONV_WAV_CHECK(wav_bytes, "Malloc for %d bytes failed", data_size);
+	if (!fread(wav_bytes, data_size, 1, fh)) {
+		free(wav_bytes);
+		QOACONV_WAV_CHECK(0, "Read error or unexpected end of file for %d bytes: %s", data_size, path);
+	}
 	fclose(fh);
 
 	desc->samplerate = samplerate;
@@ -193,7 +225,7 @@ short *qoaconv_wav_read(const char *path, qoa_desc *desc) {
 
 		drmp3_config mp3;
 		short* sample_data = drmp3_open_file_and_read_pcm_frames_s16(path, &mp3, &samples, NULL);
-		QOACONV_ASSERT(sample_data, "Can't decode MP3");
+		QOACONV_CHECK(sample_data, NULL, "Can't decode MP3 %s", path);
 
 		desc->samplerate = mp3.sampleRate;
 		desc->channels = mp3.channels;
@@ -214,7 +246,7 @@ short *qoaconv_wav_read(const char *path, qoa_desc *desc) {
 		unsigned int samplerate;
 		drflac_uint64 samples;
 		short* sample_data = drflac_open_file_and_read_pcm_frames_s16(path, &channels, &samplerate, &samples, NULL);
-		QOACONV_ASSERT(sample_data, "Can't decode FLAC");
+		QOACONV_CHECK(sample_data, NULL, "Can't decode FLAC %s", path);
 
 		desc->samplerate = samplerate;
 		desc->channels = channels;
@@ -229,44 +261,47 @@ short *qoaconv_wav_read(const char *path, qoa_desc *desc) {
 /* -----------------------------------------------------------------------------
 	Main */
 
-int main(int argc, char **argv) {
-	QOACONV_ASSERT(argc >= 3, "\nUsage: qoaconv in.{wav,mp3,flac,qoa} out.{wav,qoa}")
-
+int qoaconv_convert(const char *in_path, const char *out_path) {
 	qoa_desc desc;
 	short *sample_data = NULL;
 
+	QOACONV_CHECK(
+		QOACONV_STR_ENDS_WITH(out_path, ".wav") || QOACONV_STR_ENDS_WITH(out_path, ".qoa"), 0,
+		"Unknown file type for %s", out_path
+	);
+
 
 	/* Decode input */
 
-	if (QOACONV_STR_ENDS_WITH(argv[1], ".wav")) {
-		sample_data = qoaconv_wav_read(argv[1], &desc);
+	if (QOACONV_STR_ENDS_WITH(in_path, ".wav")) {
+		sample_data = qoaconv_wav_read(in_path, &desc);
 	}
-	else if (QOACONV_STR_ENDS_WITH(argv[1], ".mp3")) {
+	else if (QOACONV_STR_ENDS_WITH(in_path, ".mp3")) {
 		#ifdef QOACONV_HAS_DRMP3
-			sample_data = qoaconv_mp3_read(argv[1], &desc);
+			sample_data = qoaconv_mp3_read(in_path, &desc);
 		#else
-			QOACONV_ABORT("qoaconv was not compiled with an MP3 decoder (QOACONV_HAS_DRMP3)");
+			QOACONV_CHECK(0, 0, "qoaconv was not compiled with an MP3 decoder (QOACONV_HAS_DRMP3)");
 		#endif
 	}
-	else if (QOACONV_STR_ENDS_WITH(argv[1], ".flac")) {
+	else if (QOACONV_STR_ENDS_WITH(in_path, ".flac")) {
 		#ifdef QOACONV_HAS_DRFLAC
-			sample_data = qoaconv_flac_read(argv[1], &desc);
+			sample_data = qoaconv_flac_read(in_path, &desc);
 		#else
-			QOACONV_ABORT("qoaconv was not compiled with a FLAC decoder (QOACONV_HAS_DRFLAC)");
+			QOACONV_CHECK(0, 0, "qoaconv was not compiled with a FLAC decoder (QOACONV_HAS_DRFLAC)");
 		#endif
 	}
-	else if (QOACONV_STR_ENDS_WITH(argv[1], ".qoa")) {
-		sample_data = qoa_read(argv[1], &desc);
+	else if (QOACONV_STR_ENDS_WITH(in_path, ".qoa")) {
+		sample_data = qoa_read(in_path, &desc);
 	}
 	else {
-		QOACONV_ABORT("Unknown file type for %s", argv[1]);
+		QOACONV_CHECK(0, 0, "Unknown file type for %s", in_path);
 	}
 
-	QOACONV_ASSERT(sample_data, "Can't load/decode %s", argv[1]);
+	QOACONV_CHECK(sample_data, 0, "Can't load/decode %s", in_path);
 
 	printf(
 		"%s: channels: %d, samplerate: %d hz, samples per channel: %d, duration: %d sec\n",
-		argv[1], desc.channels, desc.samplerate, desc.samples, desc.samples/desc.samplerate
+		in_path, desc.channels, desc.samplerate, desc.samples, desc.samples/desc.samplerate
 	);
 
 
@@ -274,28 +309,55 @@ int main(int argc, char **argv) {
 	
 	int bytes_written = 0;
 	double psnr = 1.0/0.0;
-	if (QOACONV_STR_ENDS_WITH(argv[2], ".wav")) {
-		bytes_written = qoaconv_wav_write(argv[2], sample_data, &desc);
+	if (QOACONV_STR_ENDS_WITH(out_path, ".wav")) {
+		bytes_written = qoaconv_wav_write(out_path, sample_data, &desc);
 	}
-	else if (QOACONV_STR_ENDS_WITH(argv[2], ".qoa")) {
-		bytes_written = qoa_write(argv[2], sample_data, &desc);
+	else {
+		bytes_written = qoa_write(out_path, sample_data, &desc);
 		#ifdef QOA_RECORD_TOTAL_ERROR
 			/* Is this the right way to calculate the PSNR? */
 			psnr = -20.0 * log10(sqrt(desc.error/(desc.samples * desc.channels)) / 32768.0);
 		#endif
 	}
-	else {
-		QOACONV_ABORT("Unknown file type for %s", argv[2]);
-	}
-
-	QOACONV_ASSERT(bytes_written, "Can't write/encode %s", argv[2]);
 	free(sample_data);
+	QOACONV_CHECK(bytes_written, 0, "Can't write/encode %s", out_path);
 
 	printf(
 		"%s: size: %d kb (%d bytes) = %.2f kbit/s, psnr: %.2f db\n",
-		argv[2], bytes_written/1024, bytes_written, 
+		out_path, bytes_written/1024, bytes_written, 
 		(((float)bytes_written*8)/((float)desc.samples/(float)desc.samplerate))/1024, psnr
 	);
 
-	return 0;
+	return bytes_written;
+}
+
+int main(int argc, char **argv) {
+	QOACONV_ASSERT(argc >= 3, "\nUsage: qoaconv in.{wav,mp3,flac,qoa} out.{wav,qoa}\n       qoaconv -r [-j threads] indir outdir")
+
+	/* Batch mode: convert all wav, mp3 and flac files in the tree to qoa */
+
+	if (strcmp(argv[1], "-r") == 0) {
+		int threads = 0;
+		int args_start = 2;
+		if (argc >= 6 && strcmp(argv[2], "-j") == 0) {
+			threads = atoi(argv[3]);
+			args_start = 4;
+		}
+		QOACONV_ASSERT(argc >= args_start + 2, "\nUsage: qoaconv -r [-j threads] indir outdir");
+
+		const char *exts[] = {
+			".wav",
+			#ifdef QOACONV_HAS_DRMP3
+				".mp3",
+			#endif
+			#ifdef QOACONV_HAS_DRFLAC
+				".flac",
+			#endif
+			NULL
+		};
+		int failed = conv_batch(argv[args_start], exts, argv[args_start + 1], ".qoa", ".qoaconv-cache", threads, qoaconv_convert);
+		return failed ? 1 : 0;
+	}
+
+	return qoaconv_convert(argv[1], argv[2]) ? 0 : 1;
 }
@@ -10,9 +10,10 @@ Requires:
 	-"stb_image.h" (https://github.com/nothings/stb/blob/master/stb_image.h)
 	-"stb_image_write.h" (https://github.com/nothings/stb/blob/master/stb_image_write.h)
 	-"qoi.h" (https://github.com/phoboslab/qoi/blob/master/qoi.h)
+	-"conv_batch.h"
 
 Compile with: 
-	gcc qoiconv.c -std=c99 -O3 -o qoiconv
+	gcc qoiconv.c -std=gnu99 -O3 -lpthread -o qoiconv
 
 */
 
@@ -28,24 +29,19 @@ Compile with:
 #define QOI_IMPLEMENTATION
 #include "qoi.h"
 
+#define CONV_BATCH_IMPLEMENTATION
+#include "conv_batch.h"
 
-#define STR_ENDS_WITH(S, E) (strcmp(S + strlen(S) - (sizeof(E)-1), E) == 0)
 
-int main(int argc, char **argv) {
-	if (argc < 3) {
-		puts("Usage: qoiconv <infile> <outfile>");
-		puts("Examples:");
-		puts("  qoiconv input.png output.qoi");
-		puts("  qoiconv input.qoi output.png");
-		exit(1);
-	}
+#define STR_ENDS_WITH(S, E) (strcmp(S + strlen(S) - (sizeof(E)-1), E) == 0)
 
+int convert(const char *in_path, const char *out_path) {
 	void *pixels = NULL;
 	int w, h, channels;
-	if (STR_ENDS_WITH(argv[1], ".png")) {
-		if(!stbi_info(argv[1], &w, &h, &channels)) {
-			printf("Couldn't read header %s\n", argv[1]);
-			exit(1);
+	if (STR_ENDS_WITH(in_path, ".png")) {
+		if(!stbi_info(in_path, &w, &h, &channels)) {
+			printf("Couldn't read header %s\n", in_path);
+			return 0;
 		}
 
 		// Force all odd encodings to be RGBA
@@ -53,27 +49,27 @@ int main(int argc, char **argv) {
 			channels = 4;
 		}
 
-		pixels = (void *)stbi_load(argv[1], &w, &h, NULL, channels);
+		pixels = (void *)stbi_load(in_path, &w, &h, NULL, channels);
 	}
-	else if (STR_ENDS_WITH(argv[1], ".qoi")) {
+	else if (STR_ENDS_WITH(in_path, ".qoi")) {
 		qoi_desc desc;
-		pixels = qoi_read(argv[1], &desc, 0);
+		pixels = qoi_read(in_path, &desc, 0);
 		channels = desc.channels;
 		w = desc.width;
 		h = desc.height;
 	}
 
 	if (pixels == NULL) {
-		printf("Couldn't load/decode %s\n", argv[1]);
-		exit(1);
+		printf("Couldn't load/decode %s\n", in_path);
+		return 0;
 	}
 
 	int encoded = 0;
-	if (STR_ENDS_WITH(argv[2], ".png")) {
-		encoded = stbi_write_png(argv[2], w, h, channels, pixels, 0);
+	if (STR_ENDS_WITH(out_path, ".png")) {
+		encoded = stbi_write_png(out_path, w, h, channels, pixels, 0);
 	}
-	else if (STR_ENDS_WITH(argv[2], ".qoi")) {
-		encoded = qoi_write(argv[2], pixels, &(qoi_desc){
+	else if (STR_ENDS_WITH(out_path, ".qoi")) {
+		encoded = qoi_write(out_path, pixels, &(qoi_desc){
 			.width = w,
 			.height = h, 
 			.channels = channels,
@@ -81,11 +77,41 @@ int main(int argc, char **argv) {
 		});
 	}
 
+	free(pixels);
 	if (!encoded) {
-		printf("Couldn't write/encode %s\n", argv[2]);
+		printf("Couldn't write/encode %s\n", out_path);
+		return 0;
+	}
+	return 1;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 3) {
+		puts("Usage: qoiconv <infile> <outfile>");
+		puts("       qoiconv -r [-j threads] <indir> <outdir>");
+		puts("Examples:");
+		puts("  qoiconv input.png output.qoi");
+		puts("  qoiconv input.qoi output.png");
+		puts("  qoiconv -r assets_src/ assets/   # convert all png files in the tree");
 		exit(1);
 	}
 
-	free(pixels);
-	return 0;
+	// Batch mode
+	if (strcmp(argv[1], "-r") == 0) {
+		int threads = 0;
+		int args_start = 2;
+		if (argc >= 6 && strcmp(argv[2], "-j") == 0) {
+			threads = atoi(argv[3]);
+			args_start = 4;
+		}
+		if (argc < args_start + 2) {
+			puts("Usage: qoiconv -r [-j threads] <indir> <outdir>");
+			exit(1);
+		}
+		const char *exts[] = {".png", NULL};
+		int failed = conv_batch(argv[args_start], exts, argv[args_start + 1], ".qoi", ".qoiconv-cache", threads, convert);
+		return failed ? 1 : 0;
+	}
+
+	return convert(argv[1], argv[2]) ? 0 : 1;
 }
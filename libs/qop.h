@@ -42,6 +42,10 @@ struct {
 	uint32_t magic;
 } qop;
 
+Files with QOP_FLAG_COMPRESSED_LZ4 store a uint32_t (little endian) with the
+decompressed size, followed by an LZ4 block (see lz4_block.h). The size in the
+index is the compressed size, including these 4 bytes.
+
 
 */
 
@@ -62,6 +66,7 @@ extern "C" {
 #define QOP_FLAG_NONE               0
 #define QOP_FLAG_COMPRESSED_ZSTD    (1 << 0)
 #define QOP_FLAG_COMPRESSED_DEFLATE (1 << 1)
+#define QOP_FLAG_COMPRESSED_LZ4     (1 << 2)
 #define QOP_FLAG_ENCRYPTED          (1 << 8)
 
 typedef struct {
@@ -6,6 +6,10 @@ SPDX-License-Identifier: MIT
 
 Command line tool to create and unpack qop archives
 
+Requires:
+	-"qop.h"
+	-"lz4_block.h"
+
 */
 
 #define _DEFAULT_SOURCE
@@ -18,8 +22,11 @@ Command line tool to create and unpack qop archives
 #define QOP_IMPLEMENTATION
 #include "qop.h"
 
+#define LZ4_BLOCK_IMPLEMENTATION
+#include "lz4_block.h"
+
 #define MAX_PATH_LEN 1024
-#define BUFFER_SIZE 4096
+#define BUFFER_SIZE (64 * 1024)
 
 #define UNUSED(x) (void)(x)
 #define STRINGIFY(x) #x
@@ -215,6 +222,23 @@ unsigned int copy_out(FILE *src, unsigned int offset, unsigned int size, const c
 	return bytes_total;
 }
 
+void unpack_compressed(qop_desc *qop, qop_file *file, const char *dest_path) {
+	unsigned char *compressed = malloc(file->size);
+	error_if(qop_read(qop, file, compressed) != file->size || file->size < 4, "Could not read %s", dest_path);
+	unsigned int size = compressed[0] | (compressed[1] << 8) | (compressed[2] << 16) | (compressed[3] << 24);
+
+	unsigned char *data = malloc(size);
+	int decompressed_len = lz4_block_decompress(compressed + 4, file->size - 4, data, size);
+	error_if(decompressed_len != size, "Could not decompress %s", dest_path);
+
+	FILE *dest = fopen(dest_path, "wb");
+	error_if(!dest, "Could not open file %s for writing", dest_path);
+	error_if(fwrite(data, 1, size, dest) != size, "Write error");
+	fclose(dest);
+	free(data);
+	free(compressed);
+}
+
 void unpack(const char *archive_path, int list_only) {
 	qop_desc qop;
 	int archive_size = qop_open(archive_path, &qop);
@@ -237,11 +261,16 @@ void unpack(const char *archive_path, int list_only) {
 		// Integrity check
 		// error_if(!qop_find(&qop, path), "could not find %s", path);
 
-		printf("%6d %016llx %10d %s\n", i, file->hash, file->size, path);
+		printf("%6d %016llx %10d %s%s\n", i, file->hash, file->size, path, file->flags & QOP_FLAG_COMPRESSED_LZ4 ? " (lz4)" : "");
 
 		if (!list_only) {
 			error_if(create_path(path, 0755) != 0, "Could not create path %s", path);
-			copy_out(qop.fh, qop.files_offset + file->offset + file->path_len, file->size, path);
+			if (file->flags & QOP_FLAG_COMPRESSED_LZ4) {
+				unpack_compressed(&qop, file, path);
+			}
+			else {
+				copy_out(qop.fh, qop.files_offset + file->offset + file->path_len, file->size, path);
+			}
 		}
 	}
 
@@ -258,6 +287,7 @@ typedef struct {
 	int len;
 	int capacity;
 	int size;
+	int compress;
 } pack_state;
 
 void write_16(unsigned int v, FILE *fh) {
@@ -311,6 +341,39 @@ unsigned int copy_into(const char *src_path, FILE *dest) {
 	return bytes_total;
 }
 
+// Write the file LZ4 compressed, if that saves at least 1/8th of its size.
+// Returns the number of bytes written, or 0 if nothing was written.
+unsigned int copy_into_compressed(const char *src_path, FILE *dest) {
+	FILE *src = fopen(src_path, "rb");
+	error_if(!src, "Could not open file %s for reading", src_path);
+	fseek(src, 0, SEEK_END);
+	unsigned int size = ftell(src);
+	fseek(src, 0, SEEK_SET);
+
+	unsigned char *data = malloc(size);
+	error_if(fread(data, 1, size, src) != size, "read error for file %s", src_path);
+	fclose(src);
+
+	unsigned int capacity = LZ4_BLOCK_COMPRESS_BOUND(size);
+	unsigned char *compressed = malloc(capacity + 4);
+	unsigned int compressed_len = lz4_block_compress(data, size, compressed + 4, capacity);
+	free(data);
+
+	if (compressed_len == 0 || compressed_len + 4 > size - size / 8) {
+		free(compressed);
+		return 0;
+	}
+
+	compressed[0] = 0xff & (size      );
+	compressed[1] = 0xff & (size >>  8);
+	compressed[2] = 0xff & (size >> 16);
+	compressed[3] = 0xff & (size >> 24);
+	int written = fwrite(compressed, 1, compressed_len + 4, dest);
+	error_if(written != compressed_len + 4, "Write error");
+	free(compressed);
+	return compressed_len + 4;
+}
+
 void add_file(const char *path, FILE *dest, pack_state *state) {
 	if (state->len >= state->capacity) {
 		state->capacity *= 2;
@@ -325,10 +388,18 @@ void add_file(const char *path, FILE *dest, pack_state *state) {
 	int path_written = fwrite(path, sizeof(char), path_len, dest);
 	error_if(path_written != path_len, "Write error");
 
-	// Copy the file into the archive
-	unsigned int size = copy_into(path, dest);
+	// Compress the file, if requested and worth it; copy it into the archive
+	// otherwise
+	unsigned short flags = QOP_FLAG_NONE;
+	unsigned int size = state->compress ? copy_into_compressed(path, dest) : 0;
+	if (size) {
+		flags = QOP_FLAG_COMPRESSED_LZ4;
+	}
+	else {
+		size = copy_into(path, dest);
+	}
 
-	printf("%6d %016llx %10d %s\n", state->len, hash, size, path);
+	printf("%6d %016llx %10d %s%s\n", state->len, hash, size, path, flags ? " (lz4)" : "");
 
 	// Collect file info for the index
 	state->files[state->len] = (qop_file){
@@ -336,7 +407,7 @@ void add_file(const char *path, FILE *dest, pack_state *state) {
 		.offset = state->size,
 		.size = size,
 		.path_len = path_len,
-		.flags = QOP_FLAG_NONE
+		.flags = flags
 	};
 	state->size += size + path_len;
 	state->len++;
@@ -366,7 +437,7 @@ void add_dir(const char *path, FILE *dest, pack_state *state) {
 	pi_dir_close(dir);
 }
 
-void pack(const char *read_dir, char **sources, int sources_len, const char *archive_path) {
+void pack(const char *read_dir, char **sources, int sources_len, const char *archive_path, int compress) {
 	FILE *dest = fopen(archive_path, "wb");
 	error_if(!dest, "Could not open file %s for writing", archive_path);
 
@@ -374,7 +445,8 @@ void pack(const char *read_dir, char **sources, int sources_len, const char *arc
 		.files = malloc(sizeof(qop_file) * 1024),
 		.len = 0,
 		.capacity = 1024,
-		.size = 0
+		.size = 0,
+		.compress = compress
 	};
 
 	if (read_dir) {
@@ -428,11 +500,16 @@ void exit_usage(void) {
 		"  qopconv -l archive.qop            # List files in archive.qop\n"
 		"  qopconv -d dir1 dir2 archive.qop  # Use dir1 prefix for reading, create\n"
 		"                                      archive.qop from files in dir1/dir2/\n"
+		"  qopconv -z dir1 archive.qop       # Create archive.qop from dir1/ with\n"
+		"                                      compressed files where it helps\n"
 		"\n"
 		"Options (mutually exclusive):\n"
 		"  -u <archive> ... unpack archive\n"
 		"  -l <archive> ... list contents of archive\n"
 		"  -d <dir> ....... change read dir when creating archives\n"
+		"\n"
+		"  -z ............. LZ4 compress files when creating archives, if that\n"
+		"                   saves at least 1/8th; may precede -d\n"
 	);
 	exit(1);
 }
@@ -451,15 +528,20 @@ int main(int argc, char **argv) {
 	}
 	else {
 		int files_start = 1;
+		int compress = 0;
 		char *read_dir = NULL;
-		if (strcmp(argv[1], "-d") == 0) {
-			read_dir = argv[2];
-			files_start = 3;
+		if (strcmp(argv[files_start], "-z") == 0) {
+			compress = 1;
+			files_start++;
+		}
+		if (argc > files_start + 1 && strcmp(argv[files_start], "-d") == 0) {
+			read_dir = argv[files_start + 1];
+			files_start += 2;
 		}
 		if (argc < 2 + files_start) {
 			exit_usage();
 		}
-		pack(read_dir, argv + files_start, argc - 1 - files_start, argv[argc-1]);
+		pack(read_dir, argv + files_start, argc - 1 - files_start, argv[argc-1], compress);
 	}
 	return 0;
 }
@@ -4,70 +4,542 @@
 #include "alloc.h"
 #include "utils.h"
 
-static uint8_t hunk[ALLOC_SIZE];
 static uint32_t bump_len = 0;
 static uint32_t temp_len = 0;
 
-static uint32_t temp_objects[ALLOC_TEMP_OBJECTS_MAX] = {};
+static struct {
+	uint32_t offset;
+	uint32_t size;
+	alloc_tag_t tag;
+} temp_objects[ALLOC_TEMP_OBJECTS_MAX] = {};
 static uint32_t temp_objects_len;
 
+static alloc_tag_t tag_stack[ALLOC_TAG_STACK_SIZE] = {ALLOC_TAG_GAME};
+static uint32_t tag_stack_len = 1;
+
+static struct {
+	uint32_t start;
+	alloc_tag_t tag;
+} tag_runs[ALLOC_TAG_RUNS_MAX];
+static uint32_t tag_runs_len = 0;
+
+static uint32_t tag_bump_len[ALLOC_TAG_MAX];
+static uint32_t tag_temp_len[ALLOC_TAG_MAX];
+static uint32_t frame_running_max[ALLOC_TAG_MAX + 1];
+static alloc_stats_t stats;
+
+static const char *tag_names[] = {
+	[ALLOC_TAG_GAME] = "game",
+	[ALLOC_TAG_IMAGES] = "images",
+	[ALLOC_TAG_SOUNDS] = "sounds",
+	[ALLOC_TAG_MAPS] = "maps",
+	[ALLOC_TAG_JSON] = "json",
+	[ALLOC_TAG_ENTITIES] = "entities",
+	[ALLOC_TAG_FRAME] = "frame",
+};
+
+
+#if ALLOC_USE_VIRTUAL_MEMORY
+	#if !defined(__linux__)
+		#error "ALLOC_USE_VIRTUAL_MEMORY is only supported on Linux"
+	#endif
+	#if ALLOC_SIZE % ALLOC_COMMIT_SIZE != 0
+		#error "ALLOC_SIZE must be a multiple of ALLOC_COMMIT_SIZE"
+	#endif
+
+	#include <sys/mman.h>
+
+	// The hunk is reserved on first use. Bump memory is committed from the
+	// front, temp memory from the back of the hunk. The regions may overlap
+	// when both are rounded up to ALLOC_COMMIT_SIZE; pages in the overlap are
+	// never released by the other side.
+	static uint8_t *hunk = NULL;
+	static uint32_t bump_committed = 0;
+	static uint32_t temp_committed = 0;
+
+	static inline uint32_t hunk_commit_size(uint32_t size) {
+		return min(((size + ALLOC_COMMIT_SIZE - 1) / ALLOC_COMMIT_SIZE) * ALLOC_COMMIT_SIZE, ALLOC_SIZE);
+	}
+
+	static void hunk_protect(uint32_t start, uint32_t end, bool commit) {
+		if (start >= end) {
+			return;
+		}
+		if (!commit) {
+			madvise(hunk + start, end - start, MADV_DONTNEED);
+		}
+		int prot = commit ? PROT_READ | PROT_WRITE : PROT_NONE;
+		error_if(mprotect(hunk + start, end - start, prot) != 0, "Failed to change protection of %d bytes in hunk mem", end - start);
+	}
+
+	static void hunk_commit(void) {
+		if (!hunk) {
+			hunk = mmap(NULL, ALLOC_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+			error_if(hunk == MAP_FAILED, "Failed to reserve %d bytes of virtual memory", ALLOC_SIZE);
+		}
+		if (bump_len > bump_committed) {
+			uint32_t end = hunk_commit_size(bump_len);
+			hunk_protect(bump_committed, end, true);
+			bump_committed = end;
+		}
+		if (temp_len > temp_committed) {
+			uint32_t end = hunk_commit_size(temp_len);
+			hunk_protect(ALLOC_SIZE - end, ALLOC_SIZE - temp_committed, true);
+			temp_committed = end;
+		}
+	}
+
+	static void hunk_release_bump(void) {
+		uint32_t keep = hunk_commit_size(bump_len);
+		if (bump_committed > keep + ALLOC_RELEASE_THRESHOLD) {
+			hunk_protect(keep, min(bump_committed, ALLOC_SIZE - temp_committed), false);
+			bump_committed = keep;
+		}
+	}
+
+	static void hunk_release_temp(void) {
+		uint32_t keep = hunk_commit_size(temp_len);
+		if (temp_committed > keep + ALLOC_RELEASE_THRESHOLD) {
+			hunk_protect(max(ALLOC_SIZE - temp_committed, bump_committed), ALLOC_SIZE - keep, false);
+			temp_committed = keep;
+		}
+	}
+#else
+	static uint8_t hunk[ALLOC_SIZE];
+
+	#define hunk_commit()
+	#define hunk_release_bump()
+	#define hunk_release_temp()
+#endif
+
+
+struct alloc_arena_t {
+	uint8_t *data;
+	uint32_t size;
+	uint32_t bump_len;
+	uint32_t temp_len;
+	uint32_t temp_objects[ALLOC_TEMP_OBJECTS_MAX];
+	uint32_t temp_objects_len;
+	bool reset_per_frame;
+};
+
+static alloc_arena_t *arenas[ALLOC_ARENAS_MAX];
+static uint32_t arenas_len = 0;
+
+// The arena that bump and temp allocations on this thread are routed to, or
+// NULL for the hunk.
+static _Thread_local alloc_arena_t *thread_arena = NULL;
+
+static void *arena_bump_alloc(alloc_arena_t *arena, uint32_t size, uint32_t align);
+static void arena_bump_reset(alloc_arena_t *arena, uint32_t index);
+static void *arena_temp_alloc(alloc_arena_t *arena, uint32_t size);
+static void arena_temp_free(alloc_arena_t *arena, void *p);
+
+
+static void usage_update(alloc_usage_t *usage, uint32_t *frame_running, uint32_t current) {
+	usage->current = current;
+	*frame_running = max(*frame_running, current);
+	usage->scene_max = max(usage->scene_max, current);
+	usage->peak = max(usage->peak, current);
+}
+
+static void stats_update(alloc_tag_t tag) {
+	usage_update(&stats.tags[tag], &frame_running_max[tag], tag_bump_len[tag] + tag_temp_len[tag]);
+	usage_update(&stats.total, &frame_running_max[ALLOC_TAG_MAX], bump_len + temp_len);
+}
+
+static void stats_bump_alloc(uint32_t index, uint32_t size) {
+	// Start a new run if the tag changed; if we're out of runs, just keep
+	// counting for the last one.
+	alloc_tag_t tag = tag_stack[tag_stack_len-1];
+	if (tag_runs_len == 0 || tag_runs[tag_runs_len-1].tag != tag) {
+		if (tag_runs_len < ALLOC_TAG_RUNS_MAX) {
+			tag_runs[tag_runs_len].start = index;
+			tag_runs[tag_runs_len].tag = tag;
+			tag_runs_len++;
+		}
+		else {
+			tag = tag_runs[tag_runs_len-1].tag;
+		}
+	}
+	tag_bump_len[tag] += size;
+	stats_update(tag);
+}
+
+static void stats_bump_reset(uint32_t index) {
+	// Walk back all runs that are (partially) above the reset index
+	uint32_t end = bump_len;
+	while (tag_runs_len > 0 && end > index) {
+		uint32_t start = tag_runs[tag_runs_len-1].start;
+		alloc_tag_t tag = tag_runs[tag_runs_len-1].tag;
+		tag_bump_len[tag] -= end - max(start, index);
+		stats.tags[tag].current = tag_bump_len[tag] + tag_temp_len[tag];
+		if (start < index) {
+			break;
+		}
+		end = start;
+		tag_runs_len--;
+	}
+}
+
 bump_mark_t bump_mark(void) {
+	if (thread_arena) {
+		return (bump_mark_t){.index = thread_arena->bump_len};
+	}
 	return (bump_mark_t){.index = bump_len};
 }
 
+static inline void *bump_alloc_internal(uint32_t size, uint32_t align) {
+	if (thread_arena) {
+		return arena_bump_alloc(thread_arena, size, align);
+	}
+
+	uint32_t start = bump_len;
+	uint32_t pad = (align - ((uintptr_t)hunk + start) % align) % align;
+	error_if(start + pad + temp_len + size >= ALLOC_SIZE, "Failed to allocate %d bytes in hunk mem", size);
+	bump_len += pad + size;
+	hunk_commit();
+	stats_bump_alloc(start, pad + size);
+	return &hunk[start + pad];
+}
+
 void *bump_alloc(uint32_t size) {
-	error_if(bump_len + temp_len + size >= ALLOC_SIZE, "Failed to allocate %d bytes in hunk mem", size);
-	void *p = &hunk[bump_len];
-	bump_len += size;
+	void *p = bump_alloc_internal(size, 1);
 	memset(p, 0, size);
 	return p;
 }
 
+void *bump_alloc_uninit(uint32_t size) {
+	void *p = bump_alloc_internal(size, 1);
+	#if ALLOC_DEBUG_POISON
+		memset(p, ALLOC_POISON_UNINIT, size);
+	#endif
+	return p;
+}
+
+void *bump_alloc_aligned(uint32_t size, uint32_t align) {
+	error_if(align == 0 || (align & (align - 1)), "Alignment %d is not a power of two", align);
+	void *p = bump_alloc_internal(size, align);
+	memset(p, 0, size);
+	return p;
+}
+
+void *bump_alloc_aligned_uninit(uint32_t size, uint32_t align) {
+	error_if(align == 0 || (align & (align - 1)), "Alignment %d is not a power of two", align);
+	void *p = bump_alloc_internal(size, align);
+	#if ALLOC_DEBUG_POISON
+		memset(p, ALLOC_POISON_UNINIT, size);
+	#endif
+	return p;
+}
+
 void bump_reset(bump_mark_t mark) {
+	if (thread_arena) {
+		arena_bump_reset(thread_arena, mark.index);
+		return;
+	}
+
 	error_if(mark.index > ALLOC_SIZE, "Invalid mem reset");
+
+	// Forget all arenas that live in the released memory
+	while (arenas_len > 0 && (uint8_t *)arenas[arenas_len-1] >= &hunk[mark.index]) {
+		arenas_len--;
+	}
+
+	#if ALLOC_DEBUG_POISON
+		if (mark.index < bump_len) {
+			memset(&hunk[mark.index], ALLOC_POISON_FREED, bump_len - mark.index);
+		}
+	#endif
+	stats_bump_reset(mark.index);
 	bump_len = mark.index;
+	stats.total.current = bump_len + temp_len;
+	hunk_release_bump();
 }
 
 void *bump_from_temp(void *temp, uint32_t offset, uint32_t size) {
+	if (thread_arena) {
+		arena_temp_free(thread_arena, temp);
+		void *p = arena_bump_alloc(thread_arena, size, 1);
+		memmove(p, (uint8_t *)temp + offset, size);
+		return p;
+	}
+
 	temp_free(temp);
 	error_if(bump_len + temp_len + size >= ALLOC_SIZE, "Failed to allocate %d bytes in hunk mem", size);
-	void *p = &hunk[bump_len];
+	uint32_t index = bump_len;
 	bump_len += size;
+	hunk_commit();
+	stats_bump_alloc(index, size);
+	void *p = &hunk[index];
 	memmove(p, (uint8_t *)temp + offset, size);
 	return p;
 }
 
 void *temp_alloc(uint32_t size) {
 	size = ((size + 7) >> 3) << 3; // allign to 8 bytes
+	if (thread_arena) {
+		void *p = arena_temp_alloc(thread_arena, size);
+		#if ALLOC_DEBUG_POISON
+			memset(p, ALLOC_POISON_UNINIT, size);
+		#endif
+		return p;
+	}
 
 	error_if(bump_len + temp_len + size >= ALLOC_SIZE, "Failed to allocate %d bytes in temp mem", size);
 	error_if(temp_objects_len >= ALLOC_TEMP_OBJECTS_MAX, "ALLOC_TEMP_OBJECTS_MAX reached");
 
 	temp_len += size;
+	hunk_commit();
 	void *p = &hunk[ALLOC_SIZE - temp_len];
-	temp_objects[temp_objects_len++] = temp_len;
+	#if ALLOC_DEBUG_POISON
+		memset(p, ALLOC_POISON_UNINIT, size);
+	#endif
+
+	alloc_tag_t tag = tag_stack[tag_stack_len-1];
+	temp_objects[temp_objects_len].offset = temp_len;
+	temp_objects[temp_objects_len].size = size;
+	temp_objects[temp_objects_len].tag = tag;
+	temp_objects_len++;
+
+	tag_temp_len[tag] += size;
+	stats_update(tag);
 	return p;
 }
 
 void temp_free(void *p) {
+	if (thread_arena) {
+		arena_temp_free(thread_arena, p);
+		return;
+	}
+
 	uint32_t offset = (uint8_t *)&hunk[ALLOC_SIZE] - (uint8_t *)p;
 	error_if(offset > ALLOC_SIZE, "Object 0x%p not in temp hunk", p);
 
 	bool found = false;
 	uint32_t remaining_max = 0;
 	for (uint32_t i = 0; i < temp_objects_len; i++) {
-		if (temp_objects[i] == offset) {
+		if (temp_objects[i].offset == offset) {
+			alloc_tag_t tag = temp_objects[i].tag;
+			tag_temp_len[tag] -= temp_objects[i].size;
+			stats.tags[tag].current = tag_bump_len[tag] + tag_temp_len[tag];
+
 			temp_objects[i--] = temp_objects[--temp_objects_len];
 			found = true;
 		}
-		else if (temp_objects[i] > remaining_max) {
-			remaining_max = temp_objects[i];
+		else if (temp_objects[i].offset > remaining_max) {
+			remaining_max = temp_objects[i].offset;
 		}
 	}
 	error_if(!found, "Object 0x%p not in temp hunk", p);
 	temp_len = remaining_max;
+	stats.total.current = bump_len + temp_len;
 }
 
 void temp_alloc_check(void) {
+	if (thread_arena) {
+		error_if(thread_arena->temp_len != 0, "Arena temp memory not free: %d object(s)", thread_arena->temp_objects_len);
+		return;
+	}
+
 	error_if(temp_len != 0, "Temp memory not free: %d object(s)", temp_objects_len);
+	hunk_release_temp();
+}
+
+
+pool_t *pool_create(uint32_t elem_size, uint32_t capacity) {
+	error_if(elem_size == 0 || capacity == 0, "Invalid pool size");
+
+	// Each element must be able to hold the free list pointer and is aligned
+	// to 8 bytes.
+	elem_size = ((max(elem_size, sizeof(void *)) + 7) >> 3) << 3;
+	error_if((uint64_t)elem_size * capacity >= ALLOC_SIZE, "Pool of %d x %d bytes exceeds hunk size", capacity, elem_size);
+
+	pool_t *pool = bump_alloc(sizeof(pool_t));
+	pool->data = bump_alloc_aligned_uninit(elem_size * capacity, 8);
+	pool->elem_size = elem_size;
+	pool->capacity = capacity;
+	return pool;
+}
+
+void *pool_alloc(pool_t *pool) {
+	void *p;
+	if (pool->free_list) {
+		p = pool->free_list;
+		pool->free_list = *(void **)p;
+	}
+	else if (pool->high < pool->capacity) {
+		p = pool->data + pool->high * pool->elem_size;
+		pool->high++;
+	}
+	else {
+		return NULL;
+	}
+
+	pool->len++;
+	memset(p, 0, pool->elem_size);
+	return p;
+}
+
+void pool_free(pool_t *pool, void *p) {
+	uint8_t *e = p;
+	error_if(
+		e < pool->data || 
+		e >= pool->data + pool->high * pool->elem_size ||
+		(e - pool->data) % pool->elem_size != 0, 
+		"Object 0x%p not in pool", p
+	);
+
+	*(void **)p = pool->free_list;
+	pool->free_list = p;
+	pool->len--;
+}
+
+void pool_reset(pool_t *pool) {
+	pool->len = 0;
+	pool->high = 0;
+	pool->free_list = NULL;
+}
+
+
+void alloc_tag_push(alloc_tag_t tag) {
+	// Allocations in arenas are not tagged
+	if (thread_arena) {
+		return;
+	}
+	error_if(tag_stack_len >= ALLOC_TAG_STACK_SIZE, "Max alloc tag stack size (%d) reached", ALLOC_TAG_STACK_SIZE);
+	tag_stack[tag_stack_len++] = tag;
+}
+
+void alloc_tag_pop(void) {
+	if (thread_arena) {
+		return;
+	}
+	error_if(tag_stack_len <= 1, "Cannot pop from empty alloc tag stack");
+	tag_stack_len--;
+}
+
+alloc_stats_t alloc_stats(void) {
+	return stats;
+}
+
+void alloc_stats_begin_frame(void) {
+	for (uint32_t i = 0; i < ALLOC_TAG_MAX; i++) {
+		stats.tags[i].frame_max = frame_running_max[i];
+		frame_running_max[i] = stats.tags[i].current;
+	}
+	stats.total.frame_max = frame_running_max[ALLOC_TAG_MAX];
+	frame_running_max[ALLOC_TAG_MAX] = stats.total.current;
+}
+
+void alloc_stats_begin_scene(void) {
+	for (uint32_t i = 0; i < ALLOC_TAG_MAX; i++) {
+		stats.tags[i].scene_max = stats.tags[i].current;
+	}
+	stats.total.scene_max = stats.total.current;
+}
+
+void alloc_stats_dump(void) {
+	printf("%-10s %10s %10s %10s %10s\n", "alloc tag", "current", "frame max", "scene max", "peak");
+	for (uint32_t i = 0; i < ALLOC_TAG_MAX; i++) {
+		alloc_usage_t *u = &stats.tags[i];
+		printf("%-10s %10u %10u %10u %10u\n", tag_names[i], u->current, u->frame_max, u->scene_max, u->peak);
+	}
+	alloc_usage_t *u = &stats.total;
+	printf("%-10s %10u %10u %10u %10u of %u\n", "total", u->current, u->frame_max, u->scene_max, u->peak, ALLOC_SIZE);
+}
+
+
+alloc_arena_t *alloc_arena(uint32_t size, bool reset_per_frame) {
+	error_if(thread_arena, "Cannot create an arena while an arena is bound");
+	error_if(arenas_len >= ALLOC_ARENAS_MAX, "ALLOC_ARENAS_MAX (%d) reached", ALLOC_ARENAS_MAX);
+
+	// Align the arena to a cache line, so that arenas used by different 
+	// threads do not share one.
+	size = ((size + 7) >> 3) << 3; // keep temp allocations 8 byte aligned
+	alloc_arena_t *arena = bump_alloc_aligned(sizeof(alloc_arena_t), 64);
+	arena->data = bump_alloc_aligned_uninit(size, 64);
+	arena->size = size;
+	arena->reset_per_frame = reset_per_frame;
+	arenas[arenas_len++] = arena;
+	return arena;
+}
+
+void alloc_arena_bind(alloc_arena_t *arena) {
+	thread_arena = arena;
+}
+
+alloc_arena_t *alloc_arena_bound(void) {
+	return thread_arena;
+}
+
+void alloc_arena_reset(alloc_arena_t *arena) {
+	error_if(arena->temp_len != 0, "Arena temp memory not free: %d object(s)", arena->temp_objects_len);
+	arena_bump_reset(arena, 0);
+}
+
+void alloc_arenas_frame_end(void) {
+	for (uint32_t i = 0; i < arenas_len; i++) {
+		if (arenas[i]->reset_per_frame) {
+			alloc_arena_reset(arenas[i]);
+		}
+	}
+}
+
+void *alloc_arena_bump_atomic(alloc_arena_t *arena, uint32_t size) {
+	size = ((size + 7) >> 3) << 3; // allign to 8 bytes
+	uint32_t index = __atomic_fetch_add(&arena->bump_len, size, __ATOMIC_RELAXED);
+	error_if(
+		(uint64_t)index + size + arena->temp_len > arena->size, 
+		"Failed to allocate %d bytes in arena", size
+	);
+	void *p = &arena->data[index];
+	memset(p, 0, size);
+	return p;
+}
+
+static void *arena_bump_alloc(alloc_arena_t *arena, uint32_t size, uint32_t align) {
+	uint32_t start = arena->bump_len;
+	uint32_t pad = (align - ((uintptr_t)arena->data + start) % align) % align;
+	error_if(start + pad + arena->temp_len + size > arena->size, "Failed to allocate %d bytes in arena", size);
+	arena->bump_len += pad + size;
+	return &arena->data[start + pad];
+}
+
+static void arena_bump_reset(alloc_arena_t *arena, uint32_t index) {
+	error_if(index > arena->size, "Invalid arena reset");
+	#if ALLOC_DEBUG_POISON
+		if (index < arena->bump_len) {
+			memset(&arena->data[index], ALLOC_POISON_FREED, arena->bump_len - index);
+		}
+	#endif
+	arena->bump_len = index;
+}
+
+static void *arena_temp_alloc(alloc_arena_t *arena, uint32_t size) {
+	error_if(arena->bump_len + arena->temp_len + size > arena->size, "Failed to allocate %d bytes in arena temp mem", size);
+	error_if(arena->temp_objects_len >= ALLOC_TEMP_OBJECTS_MAX, "ALLOC_TEMP_OBJECTS_MAX reached");
+
+	arena->temp_len += size;
+	arena->temp_objects[arena->temp_objects_len++] = arena->temp_len;
+	return &arena->data[arena->size - arena->temp_len];
+}
+
+static void arena_temp_free(alloc_arena_t *arena, void *p) {
+	uint32_t offset = (uint8_t *)&arena->data[arena->size] - (uint8_t *)p;
+	error_if(offset > arena->size, "Object 0x%p not in arena temp mem", p);
+
+	bool found = false;
+	uint32_t remaining_max = 0;
+	for (uint32_t i = 0; i < arena->temp_objects_len; i++) {
+		if (arena->temp_objects[i] == offset) {
+			arena->temp_objects[i--] = arena->temp_objects[--arena->temp_objects_len];
+			found = true;
+		}
+		else if (arena->temp_objects[i] > remaining_max) {
+			remaining_max = arena->temp_objects[i];
+		}
+	}
+	error_if(!found, "Object 0x%p not in arena temp mem", p);
+	arena->temp_len = remaining_max;
 }
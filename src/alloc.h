@@ -15,6 +15,8 @@
 // Then, when a scene is loaded the bump position is recorded. When the current
 // scene ends (i.e. engine_set_scene() is called again), the bump allocator is
 // reset to that position. Conceptually the scene is wrapped in an alloc_pool().
+// The exception is memory allocated in a scene's load_world(): it is kept as
+// long as the following scenes share the same world.
 // Thirdly, each frame is wrapped in an alloc_pool().
 
 // This all means that you can't use any memory that you allocated in one scene
@@ -50,6 +52,55 @@
 	#define ALLOC_TEMP_OBJECTS_MAX 8
 #endif
 
+// Linux only: instead of a static array, reserve the hunk as ALLOC_SIZE bytes 
+// of virtual address space and only commit pages when bump or temp memory
+// grows into them. Committed pages are released again by bump_reset() and, for
+// temp memory, at the end of each frame. This lets you set a generous 
+// ALLOC_SIZE while the resident memory tracks the actual usage.
+#if !defined(ALLOC_USE_VIRTUAL_MEMORY)
+	#define ALLOC_USE_VIRTUAL_MEMORY 0
+#endif
+
+// The granularity in which virtual memory is committed. Must be a multiple of
+// the page size; ALLOC_SIZE must be a multiple of this.
+#if !defined(ALLOC_COMMIT_SIZE)
+	#define ALLOC_COMMIT_SIZE (256 * 1024)
+#endif
+
+// Committed virtual memory is only released once more than this number of 
+// bytes are unused. This avoids repeatedly committing and releasing the same
+// pages for each frame.
+#if !defined(ALLOC_RELEASE_THRESHOLD)
+	#define ALLOC_RELEASE_THRESHOLD (4 * 1024 * 1024)
+#endif
+
+// Debug mode: fill memory from bump_alloc_uninit() and temp_alloc() with 
+// ALLOC_POISON_UNINIT and memory released by bump_reset() with 
+// ALLOC_POISON_FREED, to make reads of uninitialized or stale memory obvious.
+#if !defined(ALLOC_DEBUG_POISON)
+	#define ALLOC_DEBUG_POISON 0
+#endif
+
+#define ALLOC_POISON_UNINIT 0xCD
+#define ALLOC_POISON_FREED 0xDD
+
+// The max number of arenas alive at a time
+#if !defined(ALLOC_ARENAS_MAX)
+	#define ALLOC_ARENAS_MAX 16
+#endif
+
+// The max depth of the alloc_tag_push() stack
+#if !defined(ALLOC_TAG_STACK_SIZE)
+	#define ALLOC_TAG_STACK_SIZE 16
+#endif
+
+// The max number of alternating tag runs in bump memory that are remembered to
+// attribute bump_reset() to the right tags. Beyond that, bump allocations are
+// counted for the tag of the last run.
+#if !defined(ALLOC_TAG_RUNS_MAX)
+	#define ALLOC_TAG_RUNS_MAX 1024
+#endif
+
 
 typedef struct { uint32_t index; } bump_mark_t;
 
@@ -59,6 +110,15 @@ bump_mark_t bump_mark(void);
 // Allocate `size` bytes in bump memory
 void *bump_alloc(uint32_t size);
 
+// Allocate `size` bytes in bump memory without zeroing them. Use this only when
+// you overwrite all bytes immediately.
+void *bump_alloc_uninit(uint32_t size);
+
+// Allocate `size` bytes in bump memory, aligned to `align` bytes. `align` must
+// be a power of two. Bump memory is otherwise not aligned at all.
+void *bump_alloc_aligned(uint32_t size, uint32_t align);
+void *bump_alloc_aligned_uninit(uint32_t size, uint32_t align);
+
 // Reset the bump allocator to the given position
 void bump_reset(bump_mark_t mark);
 
@@ -93,4 +153,127 @@ void temp_free(void *p);
 // Check if temp is empty, or die()
 void temp_alloc_check(void);
 
+
+// A pool hands out fixed-size elements in constant time and allows them to be
+// freed in any order. This is meant for systems that frequently allocate and
+// free objects during a scene, e.g. particles or pathfinding nodes.
+
+// The pool's memory is bump allocated by pool_create(), so it follows the same
+// lifetime rules as all bump memory: a pool created in a scene's init() is gone
+// when the scene ends. Freed elements are kept in an intrusive free list; 
+// elements that have never been handed out are taken from the end of the pool.
+
+typedef struct {
+	uint8_t *data;
+	uint32_t elem_size;
+	uint32_t capacity;
+	uint32_t len;
+	uint32_t high;
+	void *free_list;
+} pool_t;
+
+// Create a pool for `capacity` elements of `elem_size` bytes in bump memory
+pool_t *pool_create(uint32_t elem_size, uint32_t capacity);
+
+// Allocate one zeroed element from the pool. Returns NULL if the pool is full.
+void *pool_alloc(pool_t *pool);
+
+// Return an element to the pool
+void pool_free(pool_t *pool, void *p);
+
+// Free all elements of the pool at once
+void pool_reset(pool_t *pool);
+
+
+// None of the functions above are thread-safe. Worker threads can instead bind
+// an arena: a small bump and temp allocator of its own, carved from the hunk's
+// bump memory. While an arena is bound, all bump_*() and temp_*() calls on 
+// that thread - including those made by engine functions, e.g. the lists 
+// returned by entities_by_location() - allocate from the arena. An arena must
+// only be used by one thread at a time.
+
+// Arenas follow the lifetime of the bump memory they are created in; i.e. an
+// arena created in a scene's init() is gone when the scene ends. Arenas 
+// created with reset_per_frame are reset by the engine at the end of each 
+// frame, so all work using them has to be finished by then.
+
+typedef struct alloc_arena_t alloc_arena_t;
+
+// Create an arena with `size` bytes for bump and temp memory
+alloc_arena_t *alloc_arena(uint32_t size, bool reset_per_frame);
+
+// Route all bump and temp allocations on the calling thread to the arena.
+// Pass NULL to allocate from the hunk again.
+void alloc_arena_bind(alloc_arena_t *arena);
+
+// Return the arena bound to the calling thread, or NULL
+alloc_arena_t *alloc_arena_bound(void);
+
+// Reset the arena's bump memory. Its temp memory must be empty.
+void alloc_arena_reset(alloc_arena_t *arena);
+
+// Called by the engine at the end of each frame to reset frame arenas
+void alloc_arenas_frame_end(void);
+
+// Allocate `size` zeroed bytes (aligned to 8 bytes) from the arena's bump 
+// memory. This is safe to call from any number of threads at the same time, 
+// as long as no other bump or temp allocation for this arena is in progress. 
+// Temp objects that are alive in the arena are not overwritten. Use this to 
+// gather results from many jobs in one shared frame arena.
+void *alloc_arena_bump_atomic(alloc_arena_t *arena, uint32_t size);
+
+
+// All bump and temp allocations are attributed to the tag on top of the tag
+// stack. The engine pushes the tag for its subsystems while they allocate;
+// everything else is counted as ALLOC_TAG_GAME. You may push ALLOC_TAG_GAME
+// (or any other tag) yourself to break down your own allocations.
+typedef enum {
+	ALLOC_TAG_GAME,
+	ALLOC_TAG_IMAGES,
+	ALLOC_TAG_SOUNDS,
+	ALLOC_TAG_MAPS,
+	ALLOC_TAG_JSON,
+	ALLOC_TAG_ENTITIES,
+	ALLOC_TAG_FRAME,
+	ALLOC_TAG_MAX,
+} alloc_tag_t;
+
+// Push a tag onto the tag stack
+void alloc_tag_push(alloc_tag_t tag);
+
+// Pop the last pushed tag from the tag stack
+void alloc_tag_pop(void);
+
+// Memory usage in bytes for the whole hunk or a single tag
+typedef struct {
+	// Currently allocated bytes
+	uint32_t current;
+
+	// High-water mark of the last complete frame
+	uint32_t frame_max;
+
+	// High-water mark since the current scene was set
+	uint32_t scene_max;
+
+	// High-water mark since program start
+	uint32_t peak;
+} alloc_usage_t;
+
+typedef struct {
+	// Bump and temp usage of the hunk. For the total, temp usage includes
+	// fragmentation from out of order temp_free()s.
+	alloc_usage_t total;
+	alloc_usage_t tags[ALLOC_TAG_MAX];
+} alloc_stats_t;
+
+// Return the current memory usage and high-water marks
+alloc_stats_t alloc_stats(void);
+
+// Print the memory usage and high-water marks for all tags
+void alloc_stats_dump(void);
+
+// Called by the engine to start a new frame or scene for the high-water marks
+void alloc_stats_begin_frame(void);
+void alloc_stats_begin_scene(void);
+
 #endif
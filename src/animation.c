@@ -48,24 +48,109 @@ void anim_goto_rand(anim_t *anim) {
 	anim_goto(anim, rand_int(0, anim->def->sequence_len-1));
 }
 
+// Return the index into the sequence diff seconds after the start time
+static inline int anim_frame(anim_def_t *def, double diff) {
+	double looped = max(0, diff) * def->inv_total_time;
+	return !def->loop && looped >= 1
+		? def->sequence_len - 1
+		: (looped - (int)looped) * def->sequence_len;
+}
+
+void anim_eval(anim_t **anims, uint32_t len) {
+	if (len == 0) {
+		return;
+	}
+
+	// Each distinct (def, start_time) pair gets one slot in the arrays below. 
+	// A small direct mapped table finds the slot for pairs we've already seen.
+	struct { anim_def_t *def; double start_time; uint32_t slot; } shared[ANIM_EVAL_SHARED_LEN];
+	memset(shared, 0, sizeof(shared));
+
+	// One temp allocation for all arrays, ordered by alignment
+	void *temp = temp_alloc(len * (
+		sizeof(double) + sizeof(anim_def_t *) + sizeof(float) +
+		sizeof(int32_t) + sizeof(int32_t) + sizeof(uint32_t)
+	));
+	double *diffs = temp;
+	anim_def_t **defs = (anim_def_t **)(diffs + len);
+	float *inv_total_times = (float *)(defs + len);
+	int32_t *sequence_lens = (int32_t *)(inv_total_times + len);
+	int32_t *frames = sequence_lens + len;
+	uint32_t *anim_slots = (uint32_t *)(frames + len);
+	uint32_t slots_len = 0;
+
+	for (uint32_t i = 0; i < len; i++) {
+		anim_def_t *def = anims[i]->def;
+		double start_time = anims[i]->start_time;
+		uint64_t key = (uint64_t)(uintptr_t)def ^ (uint64_t)(int64_t)(start_time * 1000003.0);
+		uint32_t h = ((key * 0x9e3779b97f4a7c15ull) >> 40) % ANIM_EVAL_SHARED_LEN;
+
+		if (shared[h].def == def && shared[h].start_time == start_time) {
+			anim_slots[i] = shared[h].slot;
+			continue;
+		}
+
+		shared[h].def = def;
+		shared[h].start_time = start_time;
+		shared[h].slot = slots_len;
+		anim_slots[i] = slots_len;
+
+		defs[slots_len] = def;
+		diffs[slots_len] = engine.time - start_time;
+		inv_total_times[slots_len] = def->loop ? def->inv_total_time : 0;
+		sequence_lens[slots_len] = def->sequence_len;
+		slots_len++;
+	}
+
+	// Compute the frames without touching the defs; this loop is branch free
+	// and can be vectorized by the compiler. Non-looping anims have their
+	// inv_total_time set to 0 above and are handled separately below.
+	for (uint32_t i = 0; i < slots_len; i++) {
+		double looped = max(0, diffs[i]) * inv_total_times[i];
+		frames[i] = (looped - (int)looped) * sequence_lens[i];
+	}
+
+	for (uint32_t i = 0; i < slots_len; i++) {
+		if (!defs[i]->loop) {
+			frames[i] = anim_frame(defs[i], diffs[i]);
+		}
+		frames[i] = defs[i]->sequence[frames[i]];
+	}
+
+	for (uint32_t i = 0; i < len; i++) {
+		uint32_t slot = anim_slots[i];
+		anims[i]->eval_def = defs[slot];
+		anims[i]->eval_diff = diffs[slot];
+		anims[i]->eval_tile = frames[slot];
+	}
+
+	temp_free(temp);
+}
+
 void anim_draw(anim_t *anim, vec2_t pos) {
 	anim_def_t *def = anim->def;
+	if (anim->color.a <= 0) {
+		return;
+	}
+
+	// Rotated frames can reach outside of the unrotated frame rect; these are
+	// culled by render_draw_rotated() instead
 	vec2i_t rs = render_size();
 	if (
-		pos.x > rs.x || pos.y > rs.y ||
-		pos.x + def->frame_size.x < 0 || pos.y + def->frame_size.y < 0 ||
-		anim->color.a <= 0
+		anim->rotation == 0 && (
+			pos.x > rs.x || pos.y > rs.y ||
+			pos.x + def->frame_size.x < 0 || pos.y + def->frame_size.y < 0
+		)
 	) {
 		return;
 	}
 
-	double diff = max(0, engine.time - anim->start_time);
-	double looped = diff * def->inv_total_time;
-
-	int frame = !def->loop && looped >= 1
-		? def->sequence_len - 1
-		: (looped - (int)looped) * def->sequence_len;
-	int tile = def->sequence[frame] + anim->tile_offset;
+	// Use the frame from anim_eval() if the anim wasn't changed since
+	double diff = engine.time - anim->start_time;
+	int tile = (anim->eval_def == def && anim->eval_diff == diff)
+		? anim->eval_tile
+		: def->sequence[anim_frame(def, diff)];
+	tile += anim->tile_offset;
 
 	if (anim->rotation == 0) {
 		image_draw_tile_ex(
@@ -74,13 +159,15 @@ void anim_draw(anim_t *anim, vec2_t pos) {
 		);
 	}
 	else {
-		render_push();
-		render_translate(vec2_add(pos, def->pivot));
-		render_rotate(anim->rotation);
-		image_draw_tile_ex(
-			def->sheet, tile, def->frame_size, vec2_mulf(def->pivot, -1), 
+		if (anim->rotation != anim->rotation_cached) {
+			anim->rotation_cached = anim->rotation;
+			anim->rotation_sin = sinf(anim->rotation);
+			anim->rotation_cos = cosf(anim->rotation);
+		}
+		image_draw_tile_rotated(
+			def->sheet, tile, def->frame_size, pos, def->pivot,
+			anim->rotation_sin, anim->rotation_cos,
 			anim->flip_x, anim->flip_y, anim->color
 		);
-		render_pop();
 	}
 }
@@ -17,6 +17,12 @@
 #include "engine.h"
 #include "utils.h"
 
+// The number of distinct (anim_def, start_time) pairs that anim_eval() 
+// remembers to share one evaluation between all anims with the same pair
+#if !defined(ANIM_EVAL_SHARED_LEN)
+	#define ANIM_EVAL_SHARED_LEN 256
+#endif
+
 typedef struct {
 	image_t *sheet;
 	vec2i_t frame_size;
@@ -36,6 +42,17 @@ typedef struct {
 	bool flip_y;
 	float rotation;
 	rgba_t color;
+
+	// Internal state: the sequence tile last evaluated for eval_def at 
+	// eval_diff seconds after start_time
+	anim_def_t *eval_def;
+	double eval_diff;
+	uint16_t eval_tile;
+
+	// Internal state: the sin and cos of rotation_cached
+	float rotation_cached;
+	float rotation_sin;
+	float rotation_cos;
 } anim_t;
 
 // Create an anim_def with the given sheet, frame_size, frame_time and sequence.
@@ -65,6 +82,12 @@ void anim_goto_rand(anim_t *anim);
 // Return the number of times this animation has played through
 uint32_t anim_looped(anim_t *anim);
 
+// Evaluate the current frame of all anims at once, so that a subsequent 
+// anim_draw() doesn't need to. Anims with the same def and start_time (e.g.
+// all coins spawned with the level) are only evaluated once. This is called
+// by the engine for all entity anims before drawing them.
+void anim_eval(anim_t **anims, uint32_t len);
+
 // Draw the animation at the given pos
 void anim_draw(anim_t *anim, vec2_t pos);
 
@@ -7,6 +7,8 @@
 #include "utils.h"
 #include "image.h"
 #include "sound.h"
+#include "loader.h"
+#include "level.h"
 
 engine_t engine = {
 	.time_real = 0,
@@ -21,30 +23,62 @@ engine_t engine = {
 
 static scene_t *scene = NULL;
 static scene_t *scene_next = NULL;
+static scene_t *scene_preloaded = NULL;
 
 static texture_mark_t init_textures_mark;
 static image_mark_t init_images_mark;
 static bump_mark_t init_bump_mark;
 static sound_mark_t init_sounds_mark;
+static entity_types_mark_t init_entity_types_mark;
+
+// The world that is currently loaded and the marks after loading it
+static void (*world_loaded)(void) = NULL;
+static texture_mark_t world_textures_mark;
+static image_mark_t world_images_mark;
+static bump_mark_t world_bump_mark;
+static sound_mark_t world_sounds_mark;
+static entity_types_mark_t world_entity_types_mark;
 
 static bool is_running = false;
 
+#if PLATFORM_HOT_RELOAD
+	// The path of the last level loaded, to restart the scene when it changed
+	static char level_path[PLATFORM_MAX_PATH];
+#endif
+
 extern void main_init(void);
 extern void main_cleanup(void);
 
 void engine_init(void) {
-	engine.time_real = platform_now();
+	double time_start = platform_now();
+	engine.time_real = time_start;
+
 	render_init(platform_screen_size());
+	images_init();
+	double time_render = platform_now();
+
 	sound_init(platform_samplerate());
 	platform_set_audio_mix_cb(sound_mix_stereo);
 	input_init();
+	double time_sound_input = platform_now();
+
 	entities_init();
+	double time_entities = platform_now();
+
 	main_init();
+	double time_main = platform_now();
+
+	engine.startup.render = time_render - time_start;
+	engine.startup.sound_input = time_sound_input - time_render;
+	engine.startup.entities = time_entities - time_sound_input;
+	engine.startup.main = time_main - time_entities;
+	engine.startup.total = time_main - time_start;
 
 	init_bump_mark = bump_mark();
 	init_images_mark = images_mark();
 	init_sounds_mark = sound_mark();
 	init_textures_mark = textures_mark();
+	init_entity_types_mark = entity_types_mark();
 }
 
 void engine_cleanup(void) {
@@ -55,15 +89,172 @@ void engine_cleanup(void) {
 	render_cleanup();
 }
 
-void engine_load_level(char *json_path) {
-	json_t *json = platform_load_asset_json(json_path);
-	error_if(!json, "Could not load level json at %s", json_path);
+// Entities with settings from the level that is currently loaded; we want to
+// apply these settings only after all entities have been spawned.
+static struct { entity_t *entity; entity_settings_t *settings; } level_settings[ENTITIES_MAX];
+static uint32_t level_settings_len;
 
-	entities_reset();
-	engine.background_maps_len = 0;
-	engine.collision_map = NULL;
+static void engine_level_add_settings(entity_t *ent, entity_settings_t *settings) {
+	// The settings live as long as the level, so the name can be used in place
+	char *name = entity_setting_string(settings, "name");
+	if (name) {
+		ent->name = name;
+	}
+
+	level_settings[level_settings_len].entity = ent;
+	level_settings[level_settings_len].settings = settings;
+	level_settings_len++;
+}
+
+// Return the string at offset in the level's string table
+static char *engine_level_string(char *path, char *strings, uint32_t strings_size, uint32_t offset) {
+	error_if(offset >= strings_size, "Invalid string offset in level %s", path);
+	return strings + offset;
+}
+
+// Whether the settings blob fits into max_size bytes and all lookups in it
+// terminate within the blob
+static bool engine_level_settings_valid(entity_settings_t *settings, uint32_t max_size) {
+	if (
+		settings->size > max_size || settings->size == 0 ||
+		settings->capacity == 0 || (settings->capacity & (settings->capacity - 1)) ||
+		sizeof(entity_settings_t) + (uint64_t)settings->capacity * sizeof(entity_setting_t) > settings->size
+	) {
+		return false;
+	}
+
+	// Probing stops at an empty slot, so there must be one. Strings must be
+	// terminated within the blob.
+	bool has_empty = false;
+	bool has_strings = false;
+	for (uint32_t i = 0; i < settings->capacity; i++) {
+		entity_setting_t *setting = &settings->slots[i];
+		if (setting->type == LEVEL_SETTING_EMPTY) {
+			has_empty = true;
+		}
+		else if (setting->type == JSON_STRING || setting->type == JSON_ARRAY || setting->type == JSON_OBJECT) {
+			if (setting->offset >= settings->size) {
+				return false;
+			}
+			has_strings = true;
+		}
+	}
+	return has_empty && (!has_strings || ((char *)settings)[settings->size - 1] == '\0');
+}
+
+static void engine_load_level_binary(char *path, uint8_t *data, uint32_t len) {
+	level_header_t *header = (level_header_t *)data;
+	error_if(header->version != LEVEL_VERSION, "Level %s has version %d expected %d", path, header->version, LEVEL_VERSION);
+	error_if(
+		(uint64_t)header->strings_offset + header->strings_size > len ||
+		(uint64_t)header->maps_offset + (uint64_t)header->maps_len * sizeof(level_map_t) > len ||
+		(uint64_t)header->types_offset + (uint64_t)header->types_len * sizeof(uint32_t) > len ||
+		(uint64_t)header->entities_offset + (uint64_t)header->entities_len * sizeof(level_entity_t) > len ||
+		(uint64_t)header->settings_offset + header->settings_size > len,
+		"Level %s is truncated", path
+	);
+	error_if(
+		(header->maps_offset & 3) || (header->types_offset & 3) || (header->entities_offset & 3),
+		"Level %s has misaligned sections", path
+	);
+
+	// All strings must be terminated within the table
+	char *strings = (char *)data + header->strings_offset;
+	uint32_t strings_size = header->strings_size;
+	error_if(strings_size == 0 || strings[strings_size - 1] != '\0', "Invalid string table in level %s", path);
+
+	level_map_t *map_defs = (level_map_t *)(data + header->maps_offset);
+	uint32_t *type_names = (uint32_t *)(data + header->types_offset);
+	level_entity_t *entity_defs = (level_entity_t *)(data + header->entities_offset);
+
+	// Decode all tilesets in one batch
+	char *tileset_names[header->maps_len + 1];
+	uint32_t tileset_names_len = 0;
+	for (int i = 0; i < header->maps_len; i++) {
+		char *tileset_name = engine_level_string(path, strings, strings_size, map_defs[i].tileset_name);
+		if (tileset_name[0]) {
+			tileset_names[tileset_names_len++] = tileset_name;
+		}
+	}
+	images_load(tileset_names, tileset_names_len, NULL);
+
+	for (int i = 0; i < header->maps_len; i++) {
+		level_map_t *def = &map_defs[i];
+		uint32_t tiles_size = def->width * def->height * sizeof(uint16_t);
+		error_if((uint64_t)def->data_offset + tiles_size > len || (def->data_offset & 1), "Level %s is truncated", path);
+
+		// The tiles are copied, since the level may be in the read only 
+		// mapped archive and games may change tiles at runtime
+		map_t *map = map_with_data(def->tile_size, vec2i(def->width, def->height), NULL);
+		memcpy(map->data, data + def->data_offset, tiles_size);
+		map->distance = def->distance;
+		map->repeat = def->repeat;
+		map->foreground = def->foreground;
+		map->max_tile = def->max_tile;
+		error_if(map->distance == 0, "invalid distance for map");
+
+		// Tile anims are looked up by tile index up to max_tile
+		for (uint32_t t = 0; t < def->width * def->height; t++) {
+			error_if(map->data[t] > map->max_tile, "Level %s has a tile above max_tile", path);
+		}
+
+		char *name = engine_level_string(path, strings, strings_size, def->name);
+		error_if(strlen(name) > 15, "Map name exceeds 15 chars: %s", name);
+		strcpy(map->name, name);
 
+		char *tileset_name = engine_level_string(path, strings, strings_size, def->tileset_name);
+		if (tileset_name[0]) {
+			map->tileset = image(tileset_name);
+		}
+
+		if (str_equals(name, "collision")) {
+			engine_set_collision_map(map);
+		}
+		else {
+			engine_add_background_map(map);
+		}
+	}
+
+	// Resolve entity type names once for the whole level
+	entity_type_t types[header->types_len + 1];
+	for (int i = 0; i < header->types_len; i++) {
+		char *type_name = engine_level_string(path, strings, strings_size, type_names[i]);
+		types[i] = entity_type_by_name(type_name);
+		error_if(!types[i], "Unknown entity type %s", type_name);
+	}
+
+	for (int i = 0; i < header->entities_len; i++) {
+		level_entity_t *def = &entity_defs[i];
+		error_if(def->type >= header->types_len, "Invalid entity type in level %s", path);
+
+		entity_t *ent = entity_spawn(types[def->type], vec2(def->x, def->y));
+		if (ent && def->settings) {
+			// The settings are used in place
+			entity_settings_t *settings = (entity_settings_t *)(data + def->settings);
+			error_if(
+				(def->settings & 7) || (uint64_t)def->settings + sizeof(entity_settings_t) > len || 
+				!engine_level_settings_valid(settings, len - def->settings),
+				"Invalid entity settings in level %s", path
+			);
+			engine_level_add_settings(ent, settings);
+		}
+	}
+}
+
+static void engine_load_level_json(json_t *json) {
 	json_t *maps = json_value_for_key(json, "maps");
+
+	// Decode all tilesets in one batch
+	char *tileset_names[(maps ? maps->len : 0) + 1];
+	uint32_t tileset_names_len = 0;
+	for (int i = 0; maps && i < maps->len; i++) {
+		char *tileset_name = json_string(json_value_for_key(json_value_at(maps, i), "tilesetName"));
+		if (tileset_name && tileset_name[0]) {
+			tileset_names[tileset_names_len++] = tileset_name;
+		}
+	}
+	images_load(tileset_names, tileset_names_len, NULL);
+
 	for (int i = 0; maps && i < maps->len; i++) {
 		json_t *map_def = json_value_at(maps, i);
 		char *name = json_string(json_value_for_key(map_def, "name"));
@@ -79,13 +270,6 @@ void engine_load_level(char *json_path) {
 
 	
 	json_t *entities = json_value_for_key(json, "entities");
-
-	// Remember all entities with settings; we want to apply these settings
-	// only after all entities have been spawned.
-	// FIXME: we do this on the stack. Should maybe use the temp alloc instead.
-	struct { entity_t *entity; json_t *settings; } entity_settings[entities->len];
-	int entity_settings_len = 0;
-
 	for (int i = 0; entities && i < entities->len; i++) {
 		json_t *def = json_value_at(entities, i);
 		
@@ -103,24 +287,192 @@ void engine_load_level(char *json_path) {
 		entity_t *ent = entity_spawn(type, pos);
 		json_t *settings = json_value_for_key(def, "settings");
 		if (ent && settings && settings->type == JSON_OBJECT) {
+			engine_level_add_settings(ent, entity_settings_from_json(settings));
+		}
+	}
+}
+
+static void engine_load_level_entity(json_reader_t *r) {
+	char type_name[64] = {0};
+	vec2_t pos = vec2(0, 0);
+	uint8_t *settings = NULL;
+	uint32_t settings_len = 0;
+
+	char key[32];
+	json_read_object_begin(r);
+	while (json_read_object_next(r, key, sizeof(key))) {
+		if (str_equals(key, "type")) {
+			json_read_string(r, type_name, sizeof(type_name));
+		}
+		else if (str_equals(key, "x")) {
+			pos.x = json_read_number(r);
+		}
+		else if (str_equals(key, "y")) {
+			pos.y = json_read_number(r);
+		}
+		else if (str_equals(key, "settings") && json_read_peek(r) == JSON_OBJECT) {
+			settings = json_read_skip(r, &settings_len);
+		}
+		else {
+			json_read_skip(r, NULL);
+		}
+	}
+	error_if(!type_name[0], "Entity has no type");
+
+	entity_type_t type = entity_type_by_name(type_name);
+	error_if(!type, "Unknown entity type %s", type_name);
+
+	entity_t *ent = entity_spawn(type, pos);
+	if (ent && settings) {
+		// Only this entity's settings are parsed, and only for as long as it
+		// takes to compact them.
+		json_t *def = json_parse(settings, settings_len);
+		error_if(!def, "Invalid entity settings for %s", type_name);
+		engine_level_add_settings(ent, entity_settings_from_json(def));
+		temp_free(def);
+	}
+}
+
+// Decode the tilesets of all maps in one batch. This is a quick scan over the
+// maps that skips their data.
+static void engine_load_level_text_tilesets(uint8_t *data, uint32_t len) {
+	char names[ENGINE_MAX_BACKGROUND_MAPS + 1][PLATFORM_MAX_PATH];
+	char *tileset_names[ENGINE_MAX_BACKGROUND_MAPS + 1];
+	uint32_t tileset_names_len = 0;
+
+	char key[32];
+	json_reader_t r = json_reader(data, len);
+	json_read_object_begin(&r);
+	while (json_read_object_next(&r, key, sizeof(key))) {
+		if (!str_equals(key, "maps") || json_read_peek(&r) != JSON_ARRAY) {
+			json_read_skip(&r, NULL);
+			continue;
+		}
+
+		json_read_array_begin(&r);
+		while (json_read_array_next(&r)) {
+			json_read_object_begin(&r);
+			while (json_read_object_next(&r, key, sizeof(key))) {
+				if (
+					str_equals(key, "tilesetName") && json_read_peek(&r) == JSON_STRING &&
+					tileset_names_len < ENGINE_MAX_BACKGROUND_MAPS + 1
+				) {
+					char *name = names[tileset_names_len];
+					json_read_string(&r, name, PLATFORM_MAX_PATH);
+					if (name[0]) {
+						tileset_names[tileset_names_len++] = name;
+					}
+				}
+				else {
+					json_read_skip(&r, NULL);
+				}
+			}
+		}
+		break;
+	}
+	images_load(tileset_names, tileset_names_len, NULL);
+}
 
-			// Copy name, if we have one
-			json_t *name = json_value_for_key(settings, "name");
-			if (name && name->type == JSON_STRING) {
-				ent->name = bump_alloc(name->len + 1);
-				strcpy(ent->name, name->string);
+static void engine_load_level_text(uint8_t *data, uint32_t len) {
+	engine_load_level_text_tilesets(data, len);
+
+	char key[32];
+	json_reader_t r = json_reader(data, len);
+	json_read_object_begin(&r);
+	while (json_read_object_next(&r, key, sizeof(key))) {
+		if (str_equals(key, "maps") && json_read_peek(&r) == JSON_ARRAY) {
+			json_read_array_begin(&r);
+			while (json_read_array_next(&r)) {
+				map_t *map = map_from_json_reader(&r);
+				if (str_equals(map->name, "collision")) {
+					engine_set_collision_map(map);
+				}
+				else {
+					engine_add_background_map(map);
+				}
+			}
+		}
+		else if (str_equals(key, "entities") && json_read_peek(&r) == JSON_ARRAY) {
+			json_read_array_begin(&r);
+			while (json_read_array_next(&r)) {
+				engine_load_level_entity(&r);
 			}
+		}
+		else {
+			json_read_skip(&r, NULL);
+		}
+	}
+}
 
-			entity_settings[entity_settings_len].entity = ent;
-			entity_settings[entity_settings_len].settings = settings;
-			entity_settings_len++;
+static void engine_load_level_source(char *path) {
+	// Levels queued with loader_level() live in the loader's arena, which is
+	// reset after the scene's init()
+	uint32_t len;
+	uint8_t *data = loader_take_level(path, &len);
+	bool from_loader = (data != NULL);
+
+	// A json level queued with loader_json() has already been parsed
+	if (!from_loader) {
+		json_t *json = loader_take_json(path);
+		if (json) {
+			engine_load_level_json(json);
+			return;
 		}
 	}
 
-	for (int i = 0; i < entity_settings_len; i++) {
-		entity_settings(entity_settings[i].entity, entity_settings[i].settings);
+	bool mapped = false;
+	if (!from_loader) {
+		data = (uint8_t *)platform_map_asset(path, &len);
+		mapped = (data != NULL);
 	}
-	temp_free(json);
+	if (!from_loader && !mapped) {
+		data = platform_load_asset(path, &len);
+	}
+	error_if(!data, "Could not load level at %s", path);
+	bool owned = !from_loader && !mapped;
+
+	// Binary levels are used in place. They need to stay around for the
+	// whole scene, so unless they are in the mapped archive (and aligned)
+	// we copy them to bump memory.
+	if (len >= sizeof(level_header_t) && ((level_header_t *)data)->magic == LEVEL_MAGIC) {
+		uint8_t *level = data;
+		if (!mapped || ((uintptr_t)data & 7)) {
+			level = bump_alloc_aligned_uninit(len, 8);
+			memcpy(level, data, len);
+		}
+		if (owned) {
+			temp_free(data);
+		}
+		engine_load_level_binary(path, level, len);
+		return;
+	}
+
+	// JSON levels are read as a stream; maps are written directly into their
+	// final memory without building a json tree of the whole level.
+	engine_load_level_text(data, len);
+	if (owned) {
+		temp_free(data);
+	}
+}
+
+void engine_load_level(char *path) {
+	#if PLATFORM_HOT_RELOAD
+		snprintf(level_path, sizeof(level_path), "%s", path);
+	#endif
+
+	entities_reset();
+	engine.background_maps_len = 0;
+	engine.collision_map = NULL;
+	level_settings_len = 0;
+
+	// The level source is already gone when the settings are applied; all
+	// settings have been compacted into their own blobs.
+	engine_load_level_source(path);
+
+	for (int i = 0; i < level_settings_len; i++) {
+		entity_settings(level_settings[i].entity, level_settings[i].settings);
+	}
+	level_settings_len = 0;
 }
 
 void engine_add_background_map(map_t *map) {
@@ -136,8 +488,40 @@ void engine_set_scene(scene_t *scene) {
 	scene_next = scene;
 }
 
+void engine_preload_scene(scene_t *scene) {
+	if (scene->preload && scene != scene_preloaded) {
+		scene->preload();
+	}
+	scene_preloaded = scene;
+}
+
+#if PLATFORM_HOT_RELOAD
+	static void engine_hot_reload(void) {
+		char *path;
+		while ((path = platform_changed_asset())) {
+			if (image_reload(path) || sound_source_reload(path)) {
+				printf("Hot reload: %s\n", path);
+			}
+			else if (scene->asset_changed) {
+				scene->asset_changed(path);
+			}
+			else if (str_equals(path, level_path)) {
+				printf("Hot reload: %s; restarting scene\n", path);
+				engine_set_scene(scene);
+			}
+		}
+	}
+#endif
+
 void engine_update(void) {
 	double time_frame_start = platform_now();
+	alloc_stats_begin_frame();
+
+	#if PLATFORM_HOT_RELOAD
+		if (scene && !scene_next) {
+			engine_hot_reload();
+		}
+	#endif
 
 	// Do we want to switch scenes?
 	if (scene_next) {
@@ -146,10 +530,15 @@ void engine_update(void) {
 			scene->cleanup();
 		}
 
-		textures_reset(init_textures_mark);
-		images_reset(init_images_mark);
-		sound_reset(init_sounds_mark);
-		bump_reset(init_bump_mark);
+		// If the next scene is in the same world, we only release everything
+		// that was loaded after the world. Otherwise we release everything
+		// and load the new world.
+		bool same_world = (scene_next->load_world && scene_next->load_world == world_loaded);
+		textures_reset(same_world ? world_textures_mark : init_textures_mark);
+		images_reset(same_world ? world_images_mark : init_images_mark);
+		sound_reset(same_world ? world_sounds_mark : init_sounds_mark);
+		bump_reset(same_world ? world_bump_mark : init_bump_mark);
+		entity_types_reset(same_world ? world_entity_types_mark : init_entity_types_mark);
 		entities_reset();
 
 		engine.background_maps_len = 0;
@@ -159,10 +548,35 @@ void engine_update(void) {
 		engine.viewport = vec2(0, 0);
 
 		scene = scene_next;
+
+		// If the scene was not preloaded already, queue its assets now. The
+		// loader thread can then decode them while init() finalizes them.
+		engine_preload_scene(scene);
+
+		#if PLATFORM_HOT_RELOAD
+			level_path[0] = '\0';
+		#endif
+
+		if (!same_world) {
+			world_loaded = scene->load_world;
+			if (world_loaded) {
+				world_loaded();
+			}
+			world_textures_mark = textures_mark();
+			world_images_mark = images_mark();
+			world_sounds_mark = sound_mark();
+			world_bump_mark = bump_mark();
+			world_entity_types_mark = entity_types_mark();
+		}
+		alloc_stats_begin_scene();
+		loader_begin_scene();
+
 		if (scene->init) {
 			scene->init();
 		}
 		scene_next = NULL;
+		scene_preloaded = NULL;
+		loader_reset();
 	}
 	is_running = true;
 
@@ -175,6 +589,7 @@ void engine_update(void) {
 	engine.time += engine.tick;
 	engine.frame++;
 
+	alloc_tag_push(ALLOC_TAG_FRAME);
 	alloc_pool() {
 		if (scene->update) {
 			scene->update();
@@ -197,9 +612,11 @@ void engine_update(void) {
 		render_frame_end();
 		engine.perf.draw = (platform_now() - time_real_now) - engine.perf.update;
 	}
+	alloc_tag_pop();
 
 	input_clear();
 	temp_alloc_check();
+	alloc_arenas_frame_end();
 
 	engine.perf.draw_calls = render_draw_calls();
 	engine.perf.total =  platform_now() - time_frame_start;
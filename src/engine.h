@@ -28,6 +28,21 @@
 // Every scene in your game must provide a scene_t that specifies it's entry
 // functions.
 typedef struct {
+	// Called by engine_preload_scene() or before init(). Use it to queue the
+	// scene's assets with loader_image(), loader_sound(), loader_json() and
+	// loader_level().
+	// This may be called while another scene is running, so you must not do
+	// anything else here.
+	void (*preload)(void);
+
+	// Called before init() to load assets that are shared by all scenes of
+	// the same "world", e.g. tilesets and sounds used in all levels. Scenes
+	// with the same load_world function share the world: when switching 
+	// between them, load_world() is not called again and everything loaded 
+	// in it stays resident. Everything allocated in load_world() must not
+	// depend on the scene.
+	void (*load_world)(void);
+
 	// Called once when the scene is set. Use it to load resources and 
 	// instaiate your initial entities
 	void (*init)(void);
@@ -44,6 +59,12 @@ typedef struct {
 
 	// Called once before the next scene is set or the game ends
 	void (*cleanup)(void);
+
+	// Called with PLATFORM_HOT_RELOAD when an asset file changed that is not
+	// a loaded image or sound, e.g. the current level. Images and sounds are
+	// reloaded in place by the engine. If this is NULL, the scene is restarted
+	// when the level it loaded changed.
+	void (*asset_changed)(char *path);
 } scene_t;
 
 typedef struct {
@@ -81,6 +102,17 @@ typedef struct {
 	// drawing background_maps and entities.
 	vec2_t viewport;
 
+	// The time in seconds spent in each phase of engine_init(). The entities
+	// phase calls the load() functions of all entity types, unless they are
+	// loaded lazily (see ENTITY_LAZY_LOAD).
+	struct {
+		float render;
+		float sound_input;
+		float entities;
+		float main;
+		float total;
+	} startup;
+
 	// Various infos about the last frame
 	struct {
 		int entities;
@@ -102,9 +134,17 @@ extern engine_t engine;
 // first scene.
 void engine_set_scene(scene_t *scene);
 
-// Load a level (background maps, collision map and entities) from a json path.
+// Queue the scene's assets in the loader by calling scene->preload(), so they
+// are decoded in the background while the current scene is still running.
+// Call engine_set_scene() with the same scene once loader_done() or whenever
+// you're ready; init() will wait for any assets that are still decoding.
+void engine_preload_scene(scene_t *scene);
+
+// Load a level (background maps, collision map and entities) from a json path,
+// or from a binary level created with levelconv (see level.h). Binary levels 
+// are recognized by their header, regardless of the file name.
 // This should only be called from within your scenes init() function.
-void engine_load_level(char *json_path);
+void engine_load_level(char *path);
 
 // Add a background map; typically done through engine_load_level()
 void engine_add_background_map(map_t *map);
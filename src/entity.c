@@ -5,6 +5,7 @@
 #include "alloc.h"
 #include "trace.h"
 #include "platform.h"
+#include "level.h"
 
 
 #define ENTITY_STRINGIFY_NAME(ENUM, NAME) [ENUM] = #NAME,
@@ -14,6 +15,12 @@ static const char *entity_type_names[] = {
 
 entity_vtab_t entity_vtab[ENTITY_TYPES_COUNT];
 
+// Whether each type's load() was called and in which order, so we know which
+// types lost their assets when the engine resets to an entity_types_mark()
+static bool entity_types_loaded[ENTITY_TYPES_COUNT];
+static uint32_t entity_types_load_index[ENTITY_TYPES_COUNT];
+static uint32_t entity_types_loads_len = 0;
+
 static uint32_t entities_len = 0;
 static uint16_t entity_unique_id = 0;
 static entity_t *entities[ENTITIES_MAX];
@@ -29,7 +36,7 @@ static void entities_separate_on_y_axis(entity_t *top, entity_t *bottom, float t
 static void noop_load(void) {}
 static void noop_init(entity_t *self) {}
 static void noop_kill(entity_t *self) {}
-static void noop_settings(entity_t *self, json_t *def) {}
+static void noop_settings(entity_t *self, entity_settings_t *settings) {}
 static void noop_touch(entity_t *self, entity_t *other) {}
 static void noop_collide(entity_t *self, vec2_t normal, trace_t *trace) {}
 static void noop_trigger(entity_t *self, entity_t *other) {}
@@ -59,10 +66,13 @@ void entities_init(void) {
 		if (!entity_vtab[i].message)  { entity_vtab[i].message = noop_message; }
 	}
 
-	// Call load function on all entity types
-	for (uint32_t ti = 0; ti < ENTITY_TYPES_COUNT; ti++) {
-		entity_vtab[ti].load();
-	}
+	// Call load function on all entity types, unless they are loaded on first
+	// use
+	#if !ENTITY_LAZY_LOAD
+		for (uint32_t ti = 0; ti < ENTITY_TYPES_COUNT; ti++) {
+			entity_type_load(ti);
+		}
+	#endif
 
 	entities_reset();
 }
@@ -78,6 +88,34 @@ void entities_reset(void) {
 	entities_len = 0;
 }
 
+void entity_type_load(entity_type_t type) {
+	if (entity_types_loaded[type]) {
+		return;
+	}
+	error_if(
+		engine_is_running(), 
+		"Cannot load entity type %s during gameplay; call entity_type_load() in your scene's init()", 
+		entity_type_names[type]
+	);
+
+	entity_types_load_index[type] = entity_types_loads_len++;
+	entity_types_loaded[type] = true;
+	entity_vtab[type].load();
+}
+
+entity_types_mark_t entity_types_mark(void) {
+	return (entity_types_mark_t){.index = entity_types_loads_len};
+}
+
+void entity_types_reset(entity_types_mark_t mark) {
+	for (uint32_t ti = 0; ti < ENTITY_TYPES_COUNT; ti++) {
+		if (entity_types_loaded[ti] && entity_types_load_index[ti] >= mark.index) {
+			entity_types_loaded[ti] = false;
+		}
+	}
+	entity_types_loads_len = mark.index;
+}
+
 entity_type_t entity_type_by_name(char *type_name) {
 	for (uint32_t type = ENTITY_TYPE_NONE+1; type < ENTITY_TYPES_COUNT; type++) {
 		if (str_equals(type_name, entity_type_names[type])){
@@ -171,12 +209,50 @@ void entities_draw(vec2_t viewport) {
 	// FIXME: this copies the entity array - which is sorted by pos.x/y and
 	// sorts it again by draw_order. It's using insertion sort, which is slow
 	// for data that is not already mostly sorted.
-	entity_t **draw_ents = bump_alloc(sizeof(entity_t *) * entities_len);
+	alloc_tag_push(ALLOC_TAG_ENTITIES);
+	entity_t **draw_ents = bump_alloc_uninit(sizeof(entity_t *) * entities_len);
+	alloc_tag_pop();
 	memcpy(draw_ents, entities, entities_len * sizeof(entity_t*));
 	
 	#define SORT_DRAW_ORDER(a, b) (a->draw_order > b->draw_order)
 	sort(draw_ents, entities_len, SORT_DRAW_ORDER);
 
+	// Evaluate the current frame of all visible entity anims in one go. Anims
+	// that are culled here are still evaluated by anim_draw() if an entity 
+	// draws them somewhere else.
+	alloc_tag_push(ALLOC_TAG_ENTITIES);
+	anim_t **anims = bump_alloc_uninit(sizeof(anim_t *) * entities_len);
+	alloc_tag_pop();
+	uint32_t anims_len = 0;
+	vec2i_t rs = render_size();
+	for (int i = 0; i < entities_len; i++) {
+		entity_t *ent = draw_ents[i];
+		anim_def_t *def = ent->anim.def;
+		if (!def) {
+			continue;
+		}
+
+		// The frame rect, or for rotated anims the square around the pivot
+		// that bounds all rotations
+		vec2_t tl = vec2_sub(vec2_sub(ent->pos, viewport), ent->offset);
+		vec2_t br = vec2_add(tl, vec2_from_vec2i(def->frame_size));
+		if (ent->anim.rotation != 0) {
+			vec2_t extent = vec2(
+				max(def->pivot.x, def->frame_size.x - def->pivot.x),
+				max(def->pivot.y, def->frame_size.y - def->pivot.y)
+			);
+			float r = vec2_len(extent);
+			vec2_t center = vec2_add(tl, def->pivot);
+			tl = vec2_sub(center, vec2(r, r));
+			br = vec2_add(center, vec2(r, r));
+		}
+		if (tl.x > rs.x || tl.y > rs.y || br.x < 0 || br.y < 0) {
+			continue;
+		}
+		anims[anims_len++] = &ent->anim;
+	}
+	anim_eval(anims, anims_len);
+
 	for (int i = 0; i < entities_len; i++) {
 		entity_t *ent = draw_ents[i];
 		entity_draw(ent, viewport);
@@ -202,7 +278,8 @@ entity_list_t entities_by_proximity(entity_t *ent, float radius, entity_type_t t
 
 
 entity_list_t entities_by_location(vec2_t pos, float radius, entity_type_t type, entity_t *exclude) {
-	entity_list_t list = {.len = 0, .entities = bump_alloc(0)};
+	alloc_tag_push(ALLOC_TAG_ENTITIES);
+	entity_list_t list = {.len = 0, .entities = bump_alloc_uninit(0)};
 
 	float start_pos = pos.ENTITY_SWEEP_AXIS - radius;
 	float end_pos = start_pos + radius * 2;
@@ -249,44 +326,231 @@ entity_list_t entities_by_location(vec2_t pos, float radius, entity_type_t type,
 			float xd = entity->pos.x + (entity->pos.x < pos.x ? entity->size.x : 0) - pos.x;
 			float yd = entity->pos.y + (entity->pos.y < pos.y ? entity->size.y : 0) - pos.y;
 			if ((xd * xd) + (yd * yd) <= radius_squared) {
-				bump_alloc(sizeof(entity_ref_t));
+				bump_alloc_uninit(sizeof(entity_ref_t));
 				list.entities[list.len++] = entity_ref(entity);
 			}
 		}
 	}
 		
+	alloc_tag_pop();
 	return list;
 }
 
 entity_list_t entities_by_type(entity_type_t type) {
-	entity_list_t list = {.len = 0, .entities = bump_alloc(0)};
+	alloc_tag_push(ALLOC_TAG_ENTITIES);
+	entity_list_t list = {.len = 0, .entities = bump_alloc_uninit(0)};
 
 	// FIXME:PERF: linear search
 	for (int i = 0; i < entities_len; i++) {
 		entity_t *entity = entities[i];
 		if (entity->type == type && entity->is_alive) {
-			bump_alloc(sizeof(entity_ref_t));
+			bump_alloc_uninit(sizeof(entity_ref_t));
 			list.entities[list.len++] = entity_ref(entity);
 		}
 	}
 
+	alloc_tag_pop();
 	return list;
 }
 
 entity_list_t entities_from_json_names(json_t *targets) {
-	entity_list_t list = {.len = 0, .entities = bump_alloc(0)};
+	alloc_tag_push(ALLOC_TAG_ENTITIES);
+	entity_list_t list = {.len = 0, .entities = bump_alloc_uninit(0)};
 
 	for (int i = 0; targets && i < targets->len; i++) {
 		char *target_name = json_string(&targets->values[i]);
 		entity_t *target = entity_by_name(target_name);
 		if (target) {
-			bump_alloc(sizeof(entity_ref_t));
+			bump_alloc_uninit(sizeof(entity_ref_t));
 			list.entities[list.len++] = entity_ref(target);
 		}
 	}
+	alloc_tag_pop();
 	return list;
 }
 
+// Write v as compact json text to dest and return its length. With dest = NULL
+// only the length is computed.
+static uint32_t entity_settings_write_json(json_t *v, char *dest) {
+	#define SETTINGS_PUT(STR, LEN) do { \
+		if (dest) { memcpy(dest + len, STR, LEN); } \
+		len += LEN; \
+	} while (0)
+
+	uint32_t len = 0;
+	switch (v->type) {
+		case JSON_NULL: SETTINGS_PUT("null", 4); break;
+		case JSON_TRUE: SETTINGS_PUT("true", 4); break;
+		case JSON_FALSE: SETTINGS_PUT("false", 5); break;
+		case JSON_NUMBER: {
+			char number[32];
+			int number_len = snprintf(number, sizeof(number), "%.17g", v->number);
+			SETTINGS_PUT(number, number_len);
+			break;
+		}
+		case JSON_STRING: {
+			SETTINGS_PUT("\"", 1);
+			for (char *c = v->string; *c; c++) {
+				switch (*c) {
+					case '"':  SETTINGS_PUT("\\\"", 2); break;
+					case '\\': SETTINGS_PUT("\\\\", 2); break;
+					case '\n': SETTINGS_PUT("\\n", 2); break;
+					case '\r': SETTINGS_PUT("\\r", 2); break;
+					case '\t': SETTINGS_PUT("\\t", 2); break;
+					default: SETTINGS_PUT(c, 1);
+				}
+			}
+			SETTINGS_PUT("\"", 1);
+			break;
+		}
+		case JSON_ARRAY:
+		case JSON_OBJECT: {
+			SETTINGS_PUT(v->type == JSON_ARRAY ? "[" : "{", 1);
+			for (uint32_t i = 0; i < v->len; i++) {
+				if (i > 0) {
+					SETTINGS_PUT(",", 1);
+				}
+				if (v->type == JSON_OBJECT) {
+					json_t key = {.type = JSON_STRING, .string = json_keys(v)[i]};
+					len += entity_settings_write_json(&key, dest ? dest + len : NULL);
+					SETTINGS_PUT(":", 1);
+				}
+				len += entity_settings_write_json(&v->values[i], dest ? dest + len : NULL);
+			}
+			SETTINGS_PUT(v->type == JSON_ARRAY ? "]" : "}", 1);
+			break;
+		}
+	}
+	#undef SETTINGS_PUT
+	return len;
+}
+
+entity_settings_t *entity_settings_from_json(json_t *def) {
+	error_if(!def || def->type != JSON_OBJECT, "Entity settings are not an object");
+
+	uint32_t capacity = 2;
+	while (capacity < def->len * 2) {
+		capacity *= 2;
+	}
+
+	// Measure the string data
+	uint32_t size = sizeof(entity_settings_t) + capacity * sizeof(entity_setting_t);
+	for (uint32_t i = 0; i < def->len; i++) {
+		json_t *v = &def->values[i];
+		if (v->type == JSON_STRING) {
+			size += v->len + 1;
+		}
+		else if (v->type == JSON_ARRAY || v->type == JSON_OBJECT) {
+			size += entity_settings_write_json(v, NULL) + 1;
+		}
+	}
+
+	alloc_tag_push(ALLOC_TAG_ENTITIES);
+	entity_settings_t *settings = bump_alloc_aligned_uninit(size, 8);
+	alloc_tag_pop();
+
+	settings->size = size;
+	settings->capacity = capacity;
+	for (uint32_t i = 0; i < capacity; i++) {
+		settings->slots[i].type = LEVEL_SETTING_EMPTY;
+	}
+
+	uint32_t data_offset = sizeof(entity_settings_t) + capacity * sizeof(entity_setting_t);
+	char *data = (char *)settings;
+	for (uint32_t i = 0; i < def->len; i++) {
+		uint64_t hash = str_hash(json_keys(def)[i]);
+		uint32_t slot = hash & (capacity - 1);
+		while (settings->slots[slot].type != LEVEL_SETTING_EMPTY && settings->slots[slot].hash != hash) {
+			slot = (slot + 1) & (capacity - 1);
+		}
+
+		// Keep the first of duplicate keys, same as json_value_for_key()
+		if (settings->slots[slot].type != LEVEL_SETTING_EMPTY) {
+			continue;
+		}
+
+		json_t *v = &def->values[i];
+		entity_setting_t *setting = &settings->slots[slot];
+		setting->hash = hash;
+		setting->type = v->type;
+		setting->offset = 0;
+		setting->number = v->type == JSON_NUMBER ? v->number : 0;
+
+		if (v->type == JSON_STRING) {
+			setting->offset = data_offset;
+			memcpy(data + data_offset, v->string, v->len + 1);
+			data_offset += v->len + 1;
+		}
+		else if (v->type == JSON_ARRAY || v->type == JSON_OBJECT) {
+			setting->offset = data_offset;
+			data_offset += entity_settings_write_json(v, data + data_offset);
+			data[data_offset++] = '\0';
+		}
+	}
+
+	return settings;
+}
+
+static entity_setting_t *entity_setting(entity_settings_t *settings, char *key) {
+	if (!settings) {
+		return NULL;
+	}
+
+	uint64_t hash = str_hash(key);
+	uint32_t mask = settings->capacity - 1;
+	for (uint32_t slot = hash & mask; settings->slots[slot].type != LEVEL_SETTING_EMPTY; slot = (slot + 1) & mask) {
+		if (settings->slots[slot].hash == hash) {
+			return &settings->slots[slot];
+		}
+	}
+	return NULL;
+}
+
+json_type_t entity_setting_type(entity_settings_t *settings, char *key) {
+	entity_setting_t *setting = entity_setting(settings, key);
+	return setting ? setting->type : JSON_NULL;
+}
+
+double entity_setting_number(entity_settings_t *settings, char *key) {
+	entity_setting_t *setting = entity_setting(settings, key);
+	return setting ? setting->number : 0;
+}
+
+bool entity_setting_bool(entity_settings_t *settings, char *key) {
+	entity_setting_t *setting = entity_setting(settings, key);
+	if (!setting) {
+		return false;
+	}
+
+	// Same as json_bool(); arrays and objects are stored as compact json text
+	char *text = (char *)settings + setting->offset;
+	switch (setting->type) {
+		case JSON_TRUE:   return true;
+		case JSON_NUMBER: return setting->number != 0;
+		case JSON_STRING: return text[0] != '\0';
+		case JSON_ARRAY:  return text[1] != ']';
+		case JSON_OBJECT: return text[1] != '}';
+		default:          return false;
+	}
+}
+
+char *entity_setting_string(entity_settings_t *settings, char *key) {
+	entity_setting_t *setting = entity_setting(settings, key);
+	if (!setting || setting->type != JSON_STRING) {
+		return NULL;
+	}
+	return (char *)settings + setting->offset;
+}
+
+json_t *entity_setting_json(entity_settings_t *settings, char *key) {
+	entity_setting_t *setting = entity_setting(settings, key);
+	if (!setting || (setting->type != JSON_ARRAY && setting->type != JSON_OBJECT)) {
+		return NULL;
+	}
+	char *text = (char *)settings + setting->offset;
+	return json_parse((uint8_t *)text, strlen(text));
+}
+
 entity_ref_t entity_ref(entity_t *self) {
 	if (!self) {
 		return entity_ref_none();
@@ -311,6 +575,10 @@ entity_t *entity_spawn(entity_type_t type, vec2_t pos) {
 		return NULL;
 	}
 
+	#if ENTITY_LAZY_LOAD
+		entity_type_load(type);
+	#endif
+
 	entity_t *ent = entities[entities_len];
 	entities_len++;
 	entity_unique_id++;
@@ -12,6 +12,7 @@
 // See entity_def.h for the basic struct that is used by ENTITY_DEFINE()
 
 #include "types.h"
+#include "alloc.h"
 #include "trace.h"
 #include "entity_def.h"
 #include "../libs/pl_json.h"
@@ -57,13 +58,29 @@ struct _entity_assert_types_defined {
 	#define ENTITY_SWEEP_AXIS x
 #endif
 
+// Whether to call each entity type's load() only when the type is first 
+// spawned or loaded via entity_type_load(), instead of for all types at 
+// program start. Assets loaded this way in a scene's init() are released with 
+// the scene and loaded again when needed. Types that are spawned during 
+// gameplay (e.g. projectiles) but not already through the level must be 
+// loaded with entity_type_load() in init(), since assets can not be loaded
+// during gameplay.
+#if !defined(ENTITY_LAZY_LOAD)
+	#define ENTITY_LAZY_LOAD 0
+#endif
+
+// The settings of an entity from a level, as a compact blob with pre-hashed
+// keys. See level.h for the layout.
+typedef struct entity_settings_t entity_settings_t;
+
 // The entity_vtab_t struct must implemented by all your entity types. It holds
 // the functions to call for each entity type. All of these are optional. In
 // the simplest case you just have a global:
 // entity_vtab_t entity_vtab_mytype = {};
 typedef struct {
 	// Called once at program start, just before main_init(). Use this to
-	// load assets and animations for your entity types.
+	// load assets and animations for your entity types. With ENTITY_LAZY_LOAD
+	// this is called through entity_type_load() instead.
 	void (*load)(void);
 
 	// Called once for each entity, when the entity is created through
@@ -72,9 +89,9 @@ typedef struct {
 	void (*init)(entity_t *self);
 
 	// Called once after engine_load_level() when all entities have been 
-	// spawned. The json_t *def contains the "settings" of the entity from the
-	// level json.
-	void (*settings)(entity_t *self, json_t *def);
+	// spawned. The settings contain the "settings" of the entity from the
+	// level; read them with entity_setting_number() and friends.
+	void (*settings)(entity_t *self, entity_settings_t *settings);
 
 	// Called once per frame for each entity. The default entity_update_base()
 	// moves the entity according to its physics
@@ -112,7 +129,7 @@ typedef struct {
 extern entity_vtab_t entity_vtab[ENTITY_TYPES_COUNT];
 #define entity_is_type(SELF, TYPE)            (SELF && SELF->type == TYPE)
 #define entity_init(ENTITY)                   entity_vtab[ENTITY->type].init(ENTITY)
-#define entity_settings(ENTITY, DESC)         entity_vtab[ENTITY->type].settings(ENTITY, DESC)
+#define entity_settings(ENTITY, SETTINGS)     entity_vtab[ENTITY->type].settings(ENTITY, SETTINGS)
 #define entity_update(ENTITY)                 entity_vtab[ENTITY->type].update(ENTITY)
 #define entity_draw(ENTITY, VIEWPORT)         entity_vtab[ENTITY->type].draw(ENTITY, VIEWPORT)
 #define entity_kill(ENTITY)                   (ENTITY->is_alive = false, entity_vtab[ENTITY->type].kill(ENTITY))
@@ -133,6 +150,10 @@ entity_t *entity_by_ref(entity_ref_t ref);
 // storage is full.
 entity_t *entity_spawn(entity_type_t type, vec2_t pos);
 
+// Call the load() function of the entity type, if it is not loaded already.
+// This is only needed with ENTITY_LAZY_LOAD; entity_spawn() calls it as well.
+void entity_type_load(entity_type_t type);
+
 // Get the type enum by its type name
 entity_type_t entity_type_by_name(char *type_name);
 
@@ -188,6 +209,29 @@ entity_list_t entities_by_type(entity_type_t type);
 // list is only valid for the duration of the current frame.
 entity_list_t entities_from_json_names(json_t *targets);
 
+// Create settings from a json object in bump memory. The engine does this for
+// every entity with settings in a json level. 
+entity_settings_t *entity_settings_from_json(json_t *def);
+
+// The json type of the setting with key, or JSON_NULL if there is none
+json_type_t entity_setting_type(entity_settings_t *settings, char *key);
+
+// The number for the setting with key, or 0 if it's not a number
+double entity_setting_number(entity_settings_t *settings, char *key);
+
+// Whether the setting with key is true, in the same way as json_bool(): true,
+// non-zero numbers and non-empty strings, arrays and objects are true
+bool entity_setting_bool(entity_settings_t *settings, char *key);
+
+// The string for the setting with key or NULL if it's not a string. The string
+// lives as long as the level.
+char *entity_setting_string(entity_settings_t *settings, char *key);
+
+// Parse the array or object setting with key into temp memory. Must be
+// explicitly freed with temp_free(). Returns NULL if it's not an array or
+// object.
+json_t *entity_setting_json(entity_settings_t *settings, char *key);
+
 // Whether two entities are overlapping
 bool entity_is_touching(entity_t *self, entity_t *other);
 
@@ -199,4 +243,10 @@ void entities_reset(void);
 void entities_update(void);
 void entities_draw(vec2_t viewport);
 
+// Called by the engine to manage entity type loading. After a reset, all types
+// loaded after the mark have their load() called again on next use.
+typedef struct { uint32_t index; } entity_types_mark_t;
+entity_types_mark_t entity_types_mark(void);
+void entity_types_reset(entity_types_mark_t mark);
+
 #endif
\ No newline at end of file
@@ -1,32 +1,211 @@
 #include "font.h"
 #include "alloc.h"
 #include "platform.h"
+#include "loader.h"
 #include "utils.h"
+#include "render.h"
+#include <math.h>
 
 
 static int font_draw_line(font_t *font, vec2_t pos, char *c, font_align_t align);
 
+// A laid out text in the run cache. The quads are relative to the anchor 
+// position and bounded by min, max. The text is kept to tell hash collisions
+// apart.
+typedef struct {
+	uint64_t hash;
+	uint32_t text_offset;
+	uint32_t quads_offset;
+	uint32_t quads_len;
+	vec2_t min;
+	vec2_t max;
+} font_run_t;
+
+// Runs are stored in a direct mapped table by their hash; their quads and text
+// are appended to two buffers. When a buffer is full, all runs are dropped.
+// A run is only admitted when its hash missed the same slot before, so that 
+// text that changes every frame doesn't evict the runs of static text.
+struct font_run_cache_t {
+	font_run_t runs[FONT_RUN_CACHE_LEN];
+	uint64_t misses[FONT_RUN_CACHE_LEN];
+	uint32_t quads_len;
+	uint32_t text_len;
+	quadverts_t quads[FONT_RUN_CACHE_QUADS];
+	char text[FONT_RUN_CACHE_QUADS * 2];
+};
+
+// A code point outside of the direct table and the glyph index + 1
+// (0 = empty slot)
+struct font_glyph_slot_t {
+	uint32_t codepoint;
+	uint32_t index;
+};
+
+// The left and right code point of a kerning pair (0 = empty slot) and the
+// spacing to add between them
+struct font_kerning_slot_t {
+	uint64_t pair;
+	int32_t amount;
+};
+
+static inline uint32_t font_hash_codepoint(uint32_t codepoint) {
+	return codepoint * 0x9e3779b1u;
+}
+
+static inline uint32_t font_hash_pair(uint64_t pair) {
+	return (pair * 0x9e3779b97f4a7c15ull) >> 32;
+}
+
+// Return the smallest power of two that is at least twice len
+static uint32_t font_table_size(uint32_t len) {
+	uint32_t size = 2;
+	while (size < len * 2) {
+		size *= 2;
+	}
+	return size;
+}
+
+// Decode the next code point of the UTF-8 text and advance c past it. Invalid
+// sequences are consumed one byte at a time and return U+FFFD.
+static inline uint32_t font_utf8_next(char **c) {
+	uint8_t *s = (uint8_t *)*c;
+	if (s[0] < 0x80) {
+		(*c)++;
+		return s[0];
+	}
+
+	uint32_t codepoint;
+	int len;
+	if      ((s[0] & 0xe0) == 0xc0) { codepoint = s[0] & 0x1f; len = 2; }
+	else if ((s[0] & 0xf0) == 0xe0) { codepoint = s[0] & 0x0f; len = 3; }
+	else if ((s[0] & 0xf8) == 0xf0) { codepoint = s[0] & 0x07; len = 4; }
+	else {
+		(*c)++;
+		return 0xfffd;
+	}
+
+	for (int i = 1; i < len; i++) {
+		if ((s[i] & 0xc0) != 0x80) {
+			(*c)++;
+			return 0xfffd;
+		}
+		codepoint = (codepoint << 6) | (s[i] & 0x3f);
+	}
+	*c += len;
+	return codepoint;
+}
+
+// Return the glyph for the code point or NULL if the font doesn't have it
+static inline font_glyph_t *font_glyph(font_t *font, uint32_t codepoint) {
+	if (codepoint < FONT_GLYPHS_DIRECT) {
+		uint32_t index = font->glyphs_direct[codepoint];
+		return index ? &font->glyphs[index - 1] : NULL;
+	}
+	if (!font->glyphs_hash) {
+		return NULL;
+	}
+
+	uint32_t mask = font->glyphs_hash_mask;
+	for (uint32_t slot = font_hash_codepoint(codepoint) & mask;; slot = (slot + 1) & mask) {
+		font_glyph_slot_t *s = &font->glyphs_hash[slot];
+		if (s->index == 0) {
+			return NULL;
+		}
+		if (s->codepoint == codepoint) {
+			return &font->glyphs[s->index - 1];
+		}
+	}
+}
+
+// Return the extra spacing between the left and right code point
+static inline int font_kerning(font_t *font, uint32_t left, uint32_t right) {
+	if (!font->kerning || left == 0) {
+		return 0;
+	}
+
+	uint64_t pair = ((uint64_t)left << 32) | right;
+	uint32_t mask = font->kerning_mask;
+	for (uint32_t slot = font_hash_pair(pair) & mask;; slot = (slot + 1) & mask) {
+		font_kerning_slot_t *s = &font->kerning[slot];
+		if (s->pair == 0) {
+			return 0;
+		}
+		if (s->pair == pair) {
+			return s->amount;
+		}
+	}
+}
+
+static void font_add_glyph_index(font_t *font, uint32_t codepoint, uint32_t index) {
+	if (codepoint < FONT_GLYPHS_DIRECT) {
+		font->glyphs_direct[codepoint] = index + 1;
+		return;
+	}
+
+	uint32_t mask = font->glyphs_hash_mask;
+	uint32_t slot = font_hash_codepoint(codepoint) & mask;
+	while (font->glyphs_hash[slot].index && font->glyphs_hash[slot].codepoint != codepoint) {
+		slot = (slot + 1) & mask;
+	}
+	font->glyphs_hash[slot] = (font_glyph_slot_t){.codepoint = codepoint, .index = index + 1};
+}
+
+static void font_add_kerning(font_t *font, json_t *kerning) {
+	error_if(kerning->type != JSON_ARRAY || kerning->len % 3 != 0, "Font kerning is not an array of triplets");
+
+	uint32_t pairs_len = kerning->len / 3;
+	uint32_t size = font_table_size(pairs_len);
+	font->kerning = bump_alloc(size * sizeof(font_kerning_slot_t));
+	font->kerning_mask = size - 1;
+
+	for (uint32_t i = 0; i < kerning->len; i += 3) {
+		uint32_t left = json_number(&kerning->values[i]);
+		uint32_t right = json_number(&kerning->values[i + 1]);
+		if (left == 0) {
+			continue;
+		}
+
+		uint64_t pair = ((uint64_t)left << 32) | right;
+		uint32_t slot = font_hash_pair(pair) & font->kerning_mask;
+		while (font->kerning[slot].pair && font->kerning[slot].pair != pair) {
+			slot = (slot + 1) & font->kerning_mask;
+		}
+		font->kerning[slot].pair = pair;
+		font->kerning[slot].amount = json_number(&kerning->values[i + 2]);
+	}
+}
+
 font_t *font(char *path, char *definition_path) {
 	font_t *font = bump_alloc(sizeof(font_t));
 	font->image = image(path);
 	font->letter_spacing = 0;
 	font->color = rgba_white();
 
-	json_t *def = platform_load_asset_json(definition_path);
+	json_t *def = loader_take_json(definition_path);
+	bool preloaded = (def != NULL);
+	if (!preloaded) {
+		def = platform_load_asset_json(definition_path);
+	}
 	error_if(def == NULL, "Couldn't load font definition json");
 
 	json_t *metrics = json_value_for_key(def, "metrics");
+	json_t *codepoints = json_value_for_key(def, "codepoints");
 
-	font->first_char = json_number(json_value_for_key(def, "first_char"));
-	font->last_char = json_number(json_value_for_key(def, "last_char"));
+	int first_char = json_number(json_value_for_key(def, "first_char"));
+	int last_char = json_number(json_value_for_key(def, "last_char"));
 	font->line_height = json_number(json_value_for_key(def, "height"));
 
-	int expected_chars = font->last_char - font->first_char;
+	int expected_chars = last_char - first_char;
+	if (codepoints) {
+		error_if(codepoints->type != JSON_ARRAY, "Font codepoints are not an array");
+		expected_chars = codepoints->len;
+	}
 
 	error_if(metrics == NULL || metrics->type != JSON_ARRAY, "Font metrics are not an array");
 	error_if(metrics->len / 7 != expected_chars, "Font metrics has incorrect length (expected %d have %d)", expected_chars, metrics->len / 7);
+	error_if(expected_chars > 0xffff, "Font has more than %d glyphs", 0xffff);
 
-	font->glyphs = bump_alloc(expected_chars * sizeof(font_glyph_t));
+	font->glyphs = bump_alloc_uninit(expected_chars * sizeof(font_glyph_t));
 	for (int i = 0, a = 0; i < expected_chars; i++, a += 7) {
 		font->glyphs[i] = (font_glyph_t){
 			.pos    = {metrics->values[a + 0].number, metrics->values[a + 1].number},
@@ -36,11 +215,161 @@ font_t *font(char *path, char *definition_path) {
 		};
 	}
 
-	temp_free(def);
+	// Index all glyphs by their code point; those outside of the direct
+	// table go into the hash table
+	uint32_t hashed_len = 0;
+	for (int i = 0; i < expected_chars; i++) {
+		uint32_t codepoint = codepoints ? json_number(&codepoints->values[i]) : first_char + i;
+		hashed_len += (codepoint >= FONT_GLYPHS_DIRECT);
+	}
+
+	font->glyphs_direct = bump_alloc(FONT_GLYPHS_DIRECT * sizeof(uint16_t));
+	if (hashed_len) {
+		uint32_t size = font_table_size(hashed_len);
+		font->glyphs_hash = bump_alloc(size * sizeof(font_glyph_slot_t));
+		font->glyphs_hash_mask = size - 1;
+	}
+	for (int i = 0; i < expected_chars; i++) {
+		uint32_t codepoint = codepoints ? json_number(&codepoints->values[i]) : first_char + i;
+		font_add_glyph_index(font, codepoint, i);
+	}
+
+	json_t *kerning = json_value_for_key(def, "kerning");
+	if (kerning) {
+		font_add_kerning(font, kerning);
+	}
+
+	if (!preloaded) {
+		temp_free(def);
+	}
+
+	#if FONT_RUN_CACHE_QUADS > 0
+		font->run_cache = bump_alloc(sizeof(font_run_cache_t));
+	#endif
 	return font;
 }
 
+// The hash of everything that affects the layout and color of the text
+static uint64_t font_run_hash(font_t *font, char *text, font_align_t align) {
+	uint64_t h = str_hash(text);
+	uint32_t params[] = {align, font->color.v, font->letter_spacing, font->line_height};
+	for (int i = 0; i < len(params); i++) {
+		h ^= params[i];
+		h *= 0x5bd1e9955bd1e995ull;
+		h ^= h >> 47;
+	}
+	return h | 1; // 0 marks an empty slot
+}
+
+// Lay out the text into the run cache. Returns NULL if it doesn't fit.
+static font_run_t *font_run_build(font_t *font, char *text, font_align_t align, uint64_t hash) {
+	font_run_cache_t *cache = font->run_cache;
+
+	// Count the glyphs to see if the text fits
+	uint32_t quads_len = 0;
+	for (char *c = text; *c != '\0';) {
+		quads_len += (font_glyph(font, font_utf8_next(&c)) != NULL);
+	}
+	uint32_t text_len = strlen(text) + 1;
+	if (quads_len > FONT_RUN_CACHE_QUADS || text_len > sizeof(cache->text)) {
+		return NULL;
+	}
+	if (
+		cache->quads_len + quads_len > FONT_RUN_CACHE_QUADS ||
+		cache->text_len + text_len > sizeof(cache->text)
+	) {
+		clear(cache->runs);
+		cache->quads_len = 0;
+		cache->text_len = 0;
+	}
+
+	font_run_t *run = &cache->runs[hash % FONT_RUN_CACHE_LEN];
+	*run = (font_run_t){
+		.hash = hash,
+		.text_offset = cache->text_len,
+		.quads_offset = cache->quads_len,
+		.min = vec2(INFINITY, INFINITY),
+		.max = vec2(-INFINITY, -INFINITY)
+	};
+
+	// Same layout as font_draw() and font_draw_line()
+	texture_t texture = image_texture(font->image);
+	quadverts_t *q = cache->quads + cache->quads_len;
+	vec2_t pos = vec2(0, 0);
+	for (char *c = text; *c != '\0';) {
+		while (*c == '\n') {
+			pos.y += font->line_height;
+			c++;
+		}
+
+		vec2_t line_pos = pos;
+		if (align == FONT_ALIGN_CENTER || align == FONT_ALIGN_RIGHT) {
+			int width = font_line_width(font, c);
+			line_pos.x -= align == FONT_ALIGN_CENTER ? width / 2 : width;
+		}
+
+		uint32_t prev = 0;
+		while (*c != '\0' && *c != '\n') {
+			uint32_t codepoint = font_utf8_next(&c);
+			font_glyph_t *g = font_glyph(font, codepoint);
+			if (!g) {
+				continue;
+			}
+			line_pos.x += font_kerning(font, prev, codepoint);
+			prev = codepoint;
+
+			vec2_t tl = vec2_add(line_pos, g->offset);
+			vec2_t br = vec2_add(tl, g->size);
+			render_uv_rect_t uv = texture_uv_rect(texture, g->pos, g->size);
+			q[run->quads_len++] = (quadverts_t){.vertices = {
+				{.pos = {tl.x, tl.y}, .uv = {uv.tl.x, uv.tl.y}, .color = font->color},
+				{.pos = {br.x, tl.y}, .uv = {uv.br.x, uv.tl.y}, .color = font->color},
+				{.pos = {br.x, br.y}, .uv = {uv.br.x, uv.br.y}, .color = font->color},
+				{.pos = {tl.x, br.y}, .uv = {uv.tl.x, uv.br.y}, .color = font->color}
+			}};
+			run->min = vec2(min(run->min.x, tl.x), min(run->min.y, tl.y));
+			run->max = vec2(max(run->max.x, br.x), max(run->max.y, br.y));
+			line_pos.x += g->advance + font->letter_spacing;
+		}
+	}
+
+	memcpy(cache->text + cache->text_len, text, text_len);
+	cache->text_len += text_len;
+	cache->quads_len += run->quads_len;
+	return run;
+}
+
+
 void font_draw(font_t *font, vec2_t pos, char *text, font_align_t align) {
+	// Draw the laid out quads from the run cache, if we can
+	if (font->run_cache) {
+		font_run_cache_t *cache = font->run_cache;
+		uint64_t hash = font_run_hash(font, text, align);
+		uint32_t slot = hash % FONT_RUN_CACHE_LEN;
+		font_run_t *run = &cache->runs[slot];
+		if (run->hash != hash || strcmp(cache->text + run->text_offset, text) != 0) {
+			if (cache->misses[slot] == hash) {
+				run = font_run_build(font, text, align, hash);
+			}
+			else {
+				cache->misses[slot] = hash;
+				run = NULL;
+			}
+		}
+		if (run) {
+			vec2i_t rs = render_size();
+			if (
+				pos.x + run->min.x > rs.x || pos.y + run->min.y > rs.y ||
+				pos.x + run->max.x < 0    || pos.y + run->max.y < 0
+			) {
+				return;
+			}
+			quadverts_t *quads = cache->quads + run->quads_offset;
+			render_draw_quads(quads, run->quads_len, image_texture(font->image), pos);
+			return;
+		}
+	}
+
 	char *c = text;
 
 	while (*c != '\0') {
@@ -54,9 +383,13 @@ void font_draw(font_t *font, vec2_t pos, char *text, font_align_t align) {
 
 int font_line_width(font_t *font, char *text) {
 	int width = 0;
-	for (char *c = text; *c != '\0' && *c != '\n'; c++) {
-		if (*c >= font->first_char && *c <= font->last_char) {
-			width += font->glyphs[*c - font->first_char].advance + font->letter_spacing;
+	uint32_t prev = 0;
+	for (char *c = text; *c != '\0' && *c != '\n';) {
+		uint32_t codepoint = font_utf8_next(&c);
+		font_glyph_t *g = font_glyph(font, codepoint);
+		if (g) {
+			width += g->advance + font->letter_spacing + font_kerning(font, prev, codepoint);
+			prev = codepoint;
 		}
 	}
 	return max(0, width - font->letter_spacing);
@@ -68,16 +401,18 @@ static int font_draw_line(font_t *font, vec2_t pos, char *text, font_align_t ali
 		pos.x -= align == FONT_ALIGN_CENTER ? width / 2 : width;
 	}
 
-	vec2_t glyph_offset = vec2(0, 0);
-	vec2_t glyph_size = vec2(0, image_size(font->image).y);
-	int char_count = 0;
-	for (char *c = text; *c != '\0' && *c != '\n'; c++, char_count++) {
-		if (*c >= font->first_char && *c <= font->last_char) {
-			font_glyph_t *g = &font->glyphs[(int)(*c) - font->first_char];
+	char *c = text;
+	uint32_t prev = 0;
+	while (*c != '\0' && *c != '\n') {
+		uint32_t codepoint = font_utf8_next(&c);
+		font_glyph_t *g = font_glyph(font, codepoint);
+		if (g) {
+			pos.x += font_kerning(font, prev, codepoint);
+			prev = codepoint;
 			image_draw_ex(font->image, g->pos, g->size, vec2_add(pos, g->offset), g->size, font->color);
 			pos.x += g->advance + font->letter_spacing;
 		}
 	}
 
-	return char_count;
-}
\ No newline at end of file
+	return c - text;
+}
@@ -6,10 +6,35 @@
 // file that specifies the position, size and advance width of each glyph.
 // Use the font_tool.html to create the image and json.
 
+// Text is UTF-8 encoded. The json holds the glyphs for the code points from
+// first_char to (excluding) last_char, or, if present, for each code point in
+// the "codepoints" array. An optional "kerning" array holds the pairs of code
+// points whose spacing differs as [left, right, amount, left, right, ...].
+
 #include "types.h"
 #include "image.h"
 #include "../libs/pl_json.h"
 
+// The number of glyph quads of laid out text that each font keeps, so that
+// text that is drawn again (e.g. a hud or menu) doesn't have to be laid out 
+// for every frame. Text is only cached from the second frame it is drawn in;
+// the cache also keeps twice this number of bytes of text. 0 disables it.
+#if !defined(FONT_RUN_CACHE_QUADS)
+	#define FONT_RUN_CACHE_QUADS 1024
+#endif
+
+// Glyphs for code points below this are found through a direct lookup table,
+// all others through a hash table. The default covers Latin-1 and Latin
+// Extended-A and B.
+#if !defined(FONT_GLYPHS_DIRECT)
+	#define FONT_GLYPHS_DIRECT 0x250
+#endif
+
+// The number of different texts that each font keeps laid out
+#if !defined(FONT_RUN_CACHE_LEN)
+	#define FONT_RUN_CACHE_LEN 64
+#endif
+
 typedef struct {
 	vec2_t pos;
 	vec2_t size;
@@ -17,6 +42,10 @@ typedef struct {
 	int advance;
 } font_glyph_t;
 
+typedef struct font_glyph_slot_t font_glyph_slot_t;
+typedef struct font_kerning_slot_t font_kerning_slot_t;
+typedef struct font_run_cache_t font_run_cache_t;
+
 typedef struct {
 	// The line height when drawing multi-line text. By default, this is the
 	// image height * 1.25. Increase this to have more line spacing.
@@ -29,10 +58,14 @@ typedef struct {
 	rgba_t color;
 
 	// Internal state
-	int first_char;
-	int last_char;
 	image_t *image;
 	font_glyph_t *glyphs;
+	uint16_t *glyphs_direct;
+	font_glyph_slot_t *glyphs_hash;
+	uint32_t glyphs_hash_mask;
+	font_kerning_slot_t *kerning;
+	uint32_t kerning_mask;
+	font_run_cache_t *run_cache;
 } font_t;
 
 typedef enum {
@@ -4,84 +4,423 @@
 #include "utils.h"
 #include "engine.h"
 #include "platform.h"
+#include "loader.h"
+
+// images_load() hands each worker thread the destination for the pixels it 
+// decodes; qoi_decode() then returns that instead of temp memory.
+static _Thread_local void *image_decode_dest = NULL;
+
+static void *image_qoi_malloc(uint32_t size) {
+	void *p = image_decode_dest;
+	image_decode_dest = NULL;
+	return p ? p : temp_alloc(size);
+}
 
 #define QOI_IMPLEMENTATION
 #define QOI_NO_STDIO
-#define QOI_MALLOC temp_alloc
+#define QOI_MALLOC image_qoi_malloc
 #define QOI_FREE temp_free
 #include "../libs/qoi.h"
 
 struct image_t {
 	vec2i_t size;
 	texture_t texture;
+
+	// The uv rects of all tiles for tile_size, in the render backend's uv 
+	// space; tile_size is 0 until the first tile is drawn.
+	vec2i_t tile_size;
+	uint32_t tile_uvs_len;
+	render_uv_rect_t *tile_uvs;
 };
 
+// The path index is an open addressing hash table with image index + 1 in 
+// each slot (0 = empty). It's kept at most half full.
+#define IMAGE_PATH_INDEX_LEN (IMAGE_MAX_SOURCES * 2)
+
 static image_t images[IMAGE_MAX_SOURCES] = {};
 static char *image_paths[IMAGE_MAX_SOURCES] = {};
+static uint64_t image_path_hashes[IMAGE_MAX_SOURCES] = {};
+static uint32_t image_path_index[IMAGE_PATH_INDEX_LEN] = {};
 static uint32_t images_len = 0;
 static char *image_internal_path = "__internal";
 
+static render_uv_rect_t tile_uvs_pool[IMAGE_TILE_UVS_MAX];
+static uint32_t tile_uvs_pool_len = 0;
+
+// Return the slot in the path index for path; either the one holding the 
+// image with this path or the empty one where it should be inserted.
+static uint32_t image_path_slot(char *path, uint64_t hash) {
+	uint32_t slot = hash % IMAGE_PATH_INDEX_LEN;
+	while (image_path_index[slot]) {
+		uint32_t index = image_path_index[slot] - 1;
+		if (image_path_hashes[index] == hash && str_equals(path, image_paths[index])) {
+			break;
+		}
+		slot = (slot + 1) % IMAGE_PATH_INDEX_LEN;
+	}
+	return slot;
+}
 
 image_mark_t images_mark(void) {
-	return (image_mark_t){.index = images_len};
+	return (image_mark_t){.index = images_len, .tile_uvs_len = tile_uvs_pool_len};
 }
 
 void images_reset(image_mark_t mark) {
 	images_len = mark.index;
+
+	// Images that are kept may have built their tile uvs after the mark
+	tile_uvs_pool_len = mark.tile_uvs_len;
+	for (uint32_t i = 0; i < images_len; i++) {
+		if (images[i].tile_uvs >= tile_uvs_pool + tile_uvs_pool_len) {
+			images[i].tile_size = vec2i(0, 0);
+			images[i].tile_uvs_len = 0;
+			images[i].tile_uvs = NULL;
+		}
+	}
+
+	// Rebuild the path index from the remaining images
+	memset(image_path_index, 0, sizeof(image_path_index));
+	for (uint32_t i = 0; i < images_len; i++) {
+		if (image_paths[i] != image_internal_path) {
+			uint32_t slot = image_path_slot(image_paths[i], image_path_hashes[i]);
+			image_path_index[slot] = i + 1;
+		}
+	}
 }
 
 image_t *image_with_pixels(vec2i_t size, rgba_t *pixels) {
 	error_if(images_len >= IMAGE_MAX_SOURCES, "Max images (%d) reached", IMAGE_MAX_SOURCES);
 	error_if(engine_is_running(), "Cannot create image during gameplay");
+	alloc_tag_push(ALLOC_TAG_IMAGES);
 
 	image_paths[images_len] = image_internal_path;
 
 	image_t *img = &images[images_len];
-	img->size = size;
-	img->texture = texture_create(size, pixels);
+	*img = (image_t){.size = size, .texture = texture_create(size, pixels)};
 
+	images_len++;
+	alloc_tag_pop();
+	return img;
+}
+
+// Add a loaded image with path to the cache and upload its pixels
+static image_t *image_add(char *path, uint64_t hash, uint32_t slot, vec2i_t size, rgba_t *pixels) {
+	image_paths[images_len] = bump_alloc_uninit(strlen(path)+1);
+	strcpy(image_paths[images_len], path);
+	image_path_hashes[images_len] = hash;
+
+	image_t *img = &images[images_len];
+	*img = (image_t){.size = size, .texture = texture_create(size, pixels)};
+
+	image_path_index[slot] = images_len + 1;
 	images_len++;
 	return img;
 }
 
 image_t *image(char *path) {
-	for (uint32_t i = 0; i < images_len; i++) {
-		if (str_equals(path, image_paths[i])) {
-			return &images[i];
-		}
+	uint64_t hash = str_hash(path);
+	uint32_t slot = image_path_slot(path, hash);
+	if (image_path_index[slot]) {
+		return &images[image_path_index[slot] - 1];
 	}
 
 	error_if(images_len >= IMAGE_MAX_SOURCES, "Max images (%d) reached", IMAGE_MAX_SOURCES);
 	error_if(engine_is_running(), "Cannot load image during gameplay");
+	alloc_tag_push(ALLOC_TAG_IMAGES);
 
-	image_paths[images_len] = bump_alloc(strlen(path)+1);
-	strcpy(image_paths[images_len], path);
+	// Use the decoded pixels from the loader, if this image was queued
+	vec2i_t size;
+	rgba_t *preloaded = loader_take_image(path, &size);
+	rgba_t *pixels = preloaded;
+
+	if (!preloaded) {
+		// Decode directly from the mapped archive, if we can
+		uint32_t file_size;
+		uint8_t *data = (uint8_t *)platform_map_asset(path, &file_size);
+		bool mapped = (data != NULL);
+		if (!mapped) {
+			data = platform_load_asset(path, &file_size);
+			error_if(data == NULL, "Failed to load image %s", path);
+		}
+
+		qoi_desc desc;
+		pixels = qoi_decode(data, file_size, &desc, 4);
+		error_if(pixels == NULL, "Failed to decode image: %s", path);
+		if (!mapped) {
+			temp_free(data);
+		}
+		size = vec2i(desc.width, desc.height);
+	}
+
+	image_t *img = image_add(path, hash, slot, size, pixels);
+
+	if (!preloaded) {
+		temp_free(pixels);
+	}
+	alloc_tag_pop();
+	return img;
+}
+
+typedef struct {
+	char *path;
+	uint8_t *data;
+	uint32_t data_len;
+	bool mapped;
+	bool done;
+	vec2i_t size;
+	rgba_t *pixels;
+} image_decode_job_t;
+
+// images_load() reads the files and uploads the images on the main thread, 
+// while the jobs in between are decoded by the workers. Each job holds up to 
+// two temp objects, so only a few are in flight at a time.
+#define IMAGE_DECODE_QUEUE_LEN (IMAGE_DECODE_THREADS > 1 ? IMAGE_DECODE_THREADS - 1 : 1)
+
+// The decode queue and its worker threads. The workers are started on first 
+// use and then wait for more jobs.
+static struct {
+	platform_mutex_t *mutex;
+	platform_cond_t *cond_queued;
+	platform_cond_t *cond_done;
+	image_decode_job_t jobs[IMAGE_DECODE_QUEUE_LEN];
+	uint32_t jobs_next;
+	uint32_t jobs_queued;
+	uint32_t workers_len;
+	bool workers_failed;
+} image_decoders;
+
+static void image_decode_job(image_decode_job_t *job) {
+	qoi_desc desc;
+	image_decode_dest = job->pixels;
+	rgba_t *pixels = qoi_decode(job->data, job->data_len, &desc, 4);
+	image_decode_dest = NULL;
+	error_if(pixels != job->pixels, "Failed to decode image: %s", job->path);
+}
+
+// Take the next queued job and decode it; the mutex must be locked
+static void image_decode_next_locked(void) {
+	image_decode_job_t *job = &image_decoders.jobs[image_decoders.jobs_next++ % IMAGE_DECODE_QUEUE_LEN];
+	platform_mutex_unlock(image_decoders.mutex);
+
+	image_decode_job(job);
+
+	platform_mutex_lock(image_decoders.mutex);
+	job->done = true;
+	platform_cond_broadcast(image_decoders.cond_done);
+}
+
+static void image_decode_worker(void *data) {
+	platform_mutex_lock(image_decoders.mutex);
+	while (true) {
+		while (image_decoders.jobs_next == image_decoders.jobs_queued) {
+			platform_cond_wait(image_decoders.cond_queued, image_decoders.mutex);
+		}
+		image_decode_next_locked();
+	}
+}
+
+// Queue the job for decoding, or decode it right away without threads
+static void image_decode_queue(image_decode_job_t *job) {
+	if (!image_decoders.mutex || image_decoders.workers_len == 0) {
+		image_decode_job(job);
+		job->done = true;
+		image_decoders.jobs[image_decoders.jobs_queued++ % IMAGE_DECODE_QUEUE_LEN] = *job;
+		image_decoders.jobs_next = image_decoders.jobs_queued;
+		return;
+	}
+
+	platform_mutex_lock(image_decoders.mutex);
+	image_decoders.jobs[image_decoders.jobs_queued++ % IMAGE_DECODE_QUEUE_LEN] = *job;
+	platform_cond_broadcast(image_decoders.cond_queued);
+	platform_mutex_unlock(image_decoders.mutex);
+}
+
+// Wait for the oldest queued job and return it. We help decoding instead of
+// just waiting.
+static image_decode_job_t *image_decode_wait(uint32_t index) {
+	image_decode_job_t *job = &image_decoders.jobs[index % IMAGE_DECODE_QUEUE_LEN];
+	if (!image_decoders.mutex || image_decoders.workers_len == 0) {
+		return job;
+	}
+
+	platform_mutex_lock(image_decoders.mutex);
+	while (!job->done) {
+		if (image_decoders.jobs_next < image_decoders.jobs_queued) {
+			image_decode_next_locked();
+		}
+		else {
+			platform_cond_wait(image_decoders.cond_done, image_decoders.mutex);
+		}
+	}
+	platform_mutex_unlock(image_decoders.mutex);
+	return job;
+}
+
+void images_init(void) {
+	image_decoders.mutex = platform_mutex_create();
+	image_decoders.cond_queued = platform_cond_create();
+	image_decoders.cond_done = platform_cond_create();
+}
+
+void images_load(char **paths, uint32_t len, image_t **loaded) {
+	error_if(engine_is_running(), "Cannot load image during gameplay");
+	alloc_tag_push(ALLOC_TAG_IMAGES);
+
+	// The queue is always empty between calls, so we start counting at 0
+	if (image_decoders.mutex) {
+		platform_mutex_lock(image_decoders.mutex);
+	}
+	image_decoders.jobs_next = 0;
+	image_decoders.jobs_queued = 0;
+	if (image_decoders.mutex) {
+		while (
+			len > 1 &&
+			image_decoders.workers_len < IMAGE_DECODE_THREADS - 1 && 
+			!image_decoders.workers_failed
+		) {
+			if (!platform_thread_create(image_decode_worker, NULL)) {
+				image_decoders.workers_failed = true;
+				break;
+			}
+			image_decoders.workers_len++;
+		}
+		platform_mutex_unlock(image_decoders.mutex);
+	}
+
+	// The temp memory of finished jobs is only reclaimed once all jobs after
+	// them are finished, too. So when the jobs since the last time the queue
+	// was empty used more than IMAGE_DECODE_MEMORY, we let it run empty.
+	uint32_t uploaded = 0;
+	uint64_t temp_used = 0;
+
+	for (uint32_t i = 0; i <= len; i++) {
+		bool queue_full = image_decoders.jobs_queued - uploaded == IMAGE_DECODE_QUEUE_LEN;
+		bool memory_full = temp_used >= IMAGE_DECODE_MEMORY;
+		while (
+			uploaded < image_decoders.jobs_queued && 
+			(i == len || queue_full || memory_full)
+		) {
+			image_decode_job_t *job = image_decode_wait(uploaded++);
+			uint64_t hash = str_hash(job->path);
+			image_add(job->path, hash, image_path_slot(job->path, hash), job->size, job->pixels);
+
+			temp_free(job->pixels);
+			if (!job->mapped) {
+				temp_free(job->data);
+			}
+			queue_full = false;
+		}
+		if (uploaded == image_decoders.jobs_queued) {
+			temp_used = 0;
+		}
+		if (i == len) {
+			break;
+		}
+
+		char *path = paths[i];
+		uint64_t hash = str_hash(path);
+		uint32_t slot = image_path_slot(path, hash);
+
+		bool queued = image_path_index[slot];
+		for (uint32_t j = uploaded; j < image_decoders.jobs_queued && !queued; j++) {
+			queued = str_equals(image_decoders.jobs[j % IMAGE_DECODE_QUEUE_LEN].path, path);
+		}
+		if (queued) {
+			continue;
+		}
 
+		error_if(
+			images_len + (image_decoders.jobs_queued - uploaded) >= IMAGE_MAX_SOURCES, 
+			"Max images (%d) reached", IMAGE_MAX_SOURCES
+		);
+
+		// Images that were queued in the loader are already decoded
+		vec2i_t size;
+		rgba_t *preloaded = loader_take_image(path, &size);
+		if (preloaded) {
+			image_add(path, hash, slot, size, preloaded);
+			continue;
+		}
+
+		image_decode_job_t job = {.path = path};
+		job.data = (uint8_t *)platform_map_asset(path, &job.data_len);
+		job.mapped = (job.data != NULL);
+		if (!job.mapped) {
+			job.data = platform_load_asset(path, &job.data_len);
+			error_if(job.data == NULL, "Failed to load image %s", path);
+			temp_used += job.data_len;
+		}
+
+		// Big endian width and height from the QOI header; these are checked
+		// the same way as by qoi_decode(), before we allocate for them.
+		error_if(job.data_len < 14 || memcmp(job.data, "qoif", 4) != 0, "Failed to decode image: %s", path);
+		uint8_t *h = job.data;
+		uint32_t width = (h[4] << 24) | (h[5] << 16) | (h[6] << 8) | h[7];
+		uint32_t height = (h[8] << 24) | (h[9] << 16) | (h[10] << 8) | h[11];
+		error_if(
+			width == 0 || height == 0 || height >= QOI_PIXELS_MAX / width, 
+			"Invalid image size in %s", path
+		);
+		job.size = vec2i(width, height);
+		job.pixels = temp_alloc(width * height * sizeof(rgba_t));
+		temp_used += width * height * sizeof(rgba_t);
+
+		image_decode_queue(&job);
+	}
+
+	if (loaded) {
+		for (uint32_t i = 0; i < len; i++) {
+			loaded[i] = image(paths[i]);
+		}
+	}
+	alloc_tag_pop();
+}
+
+bool image_reload(char *path) {
+	uint32_t slot = image_path_slot(path, str_hash(path));
+	if (!image_path_index[slot]) {
+		return false;
+	}
+	image_t *img = &images[image_path_index[slot] - 1];
 
 	uint32_t file_size;
 	uint8_t *data = platform_load_asset(path, &file_size);
-	error_if(data == NULL, "Failed to load image %s", path);
+	if (!data) {
+		printf("Failed to reload image %s\n", path);
+		return false;
+	}
 
 	qoi_desc desc;
 	rgba_t *pixels = qoi_decode(data, file_size, &desc, 4);
-	error_if(pixels == NULL, "Failed to decode image: %s", path);
-	temp_free(data);
-
-	vec2i_t size = vec2i(desc.width, desc.height);
-	image_t *img = &images[images_len];
-	img->size = size;
-	img->texture = texture_create(size, pixels);
-
-	images_len++;
+	bool reloaded = pixels && desc.width == img->size.x && desc.height == img->size.y;
+	if (reloaded) {
+		texture_replace_pixels(img->texture, img->size, pixels);
+	}
+	else if (pixels) {
+		printf(
+			"Failed to reload image %s; size changed from %dx%d to %dx%d\n", 
+			path, img->size.x, img->size.y, desc.width, desc.height
+		);
+	}
+	else {
+		printf("Failed to decode image %s\n", path);
+	}
 
-	temp_free(pixels);
-	return img;
+	if (pixels) {
+		temp_free(pixels);
+	}
+	temp_free(data);
+	return reloaded;
 }
 
 vec2i_t image_size(image_t *img) {
 	return img->size;
 }
 
+texture_t image_texture(image_t *img) {
+	return img->texture;
+}
+
 void image_draw(image_t *img, vec2_t pos) {
 	vec2_t size = vec2_from_vec2i(img->size);
 	render_draw(pos, size, img->texture, vec2(0, 0), size, rgba_white());
@@ -95,21 +434,78 @@ void image_draw_tile(image_t *img, uint32_t tile, vec2i_t tile_size, vec2_t dst_
 	image_draw_tile_ex(img, tile, tile_size, dst_pos, false, false, rgba_white());
 }
 
-void image_draw_tile_ex(image_t *img, uint32_t tile, vec2i_t tile_size, vec2_t dst_pos, bool flip_x, bool flip_y, rgba_t color) {
-	vec2_t src_pos = vec2(
-		(tile * tile_size.x) % img->size.x,
-		((tile * tile_size.x) / img->size.x) * tile_size.y
-	);
+// Build the tile uv table for tile_size. Tiles are laid out in rows, same as
+// in image_draw_tile_ex().
+static void image_build_tile_uvs(image_t *img, vec2i_t tile_size) {
+	img->tile_size = tile_size;
+	img->tile_uvs_len = 0;
+	img->tile_uvs = NULL;
+
+	uint32_t len = (img->size.x / tile_size.x) * (img->size.y / tile_size.y);
+	if (len == 0 || tile_uvs_pool_len + len > IMAGE_TILE_UVS_MAX) {
+		return;
+	}
+
+	img->tile_uvs = tile_uvs_pool + tile_uvs_pool_len;
+	img->tile_uvs_len = len;
+	tile_uvs_pool_len += len;
+
 	vec2_t src_size = vec2(tile_size.x, tile_size.y);
-	vec2_t dst_size = src_size;
+	for (uint32_t tile = 0; tile < len; tile++) {
+		vec2_t src_pos = vec2(
+			(tile * tile_size.x) % img->size.x,
+			((tile * tile_size.x) / img->size.x) * tile_size.y
+		);
+		img->tile_uvs[tile] = texture_uv_rect(img->texture, src_pos, src_size);
+	}
+}
+
+render_uv_rect_t *image_tile_uvs(image_t *img, vec2i_t tile_size, uint32_t *len) {
+	if (img->tile_size.x == 0) {
+		image_build_tile_uvs(img, tile_size);
+	}
+	if (!img->tile_uvs || img->tile_size.x != tile_size.x || img->tile_size.y != tile_size.y) {
+		return NULL;
+	}
+	*len = img->tile_uvs_len;
+	return img->tile_uvs;
+}
+
+// Return the uv rect for the tile in the backend's uv space, flipped as
+// requested. This uses the image's tile uv table if it has one for the tile.
+static inline render_uv_rect_t image_tile_uv_rect(image_t *img, uint32_t tile, vec2i_t tile_size, bool flip_x, bool flip_y) {
+	// Build the uv table on the first draw
+	if (img->tile_size.x == 0) {
+		image_build_tile_uvs(img, tile_size);
+	}
+
+	render_uv_rect_t uv;
+	if (tile < img->tile_uvs_len && img->tile_size.x == tile_size.x && img->tile_size.y == tile_size.y) {
+		uv = img->tile_uvs[tile];
+	}
+	else {
+		vec2_t src_pos = vec2(
+			(tile * tile_size.x) % img->size.x,
+			((tile * tile_size.x) / img->size.x) * tile_size.y
+		);
+		uv = texture_uv_rect(img->texture, src_pos, vec2(tile_size.x, tile_size.y));
+	}
 
 	if (flip_x) {
-		src_pos.x = src_pos.x + tile_size.x;
-		src_size.x = -tile_size.x;
+		swap(uv.tl.x, uv.br.x);
 	}
 	if (flip_y) {
-		src_pos.y = src_pos.y + tile_size.y;
-		src_size.y = -tile_size.y;
+		swap(uv.tl.y, uv.br.y);
 	}
-	render_draw(dst_pos, dst_size, img->texture, src_pos, src_size, color);
+	return uv;
+}
+
+void image_draw_tile_ex(image_t *img, uint32_t tile, vec2i_t tile_size, vec2_t dst_pos, bool flip_x, bool flip_y, rgba_t color) {
+	render_uv_rect_t uv = image_tile_uv_rect(img, tile, tile_size, flip_x, flip_y);
+	render_draw_uv_rect(dst_pos, vec2(tile_size.x, tile_size.y), img->texture, uv, color);
+}
+
+void image_draw_tile_rotated(image_t *img, uint32_t tile, vec2i_t tile_size, vec2_t dst_pos, vec2_t pivot, float sin, float cos, bool flip_x, bool flip_y, rgba_t color) {
+	render_uv_rect_t uv = image_tile_uv_rect(img, tile, tile_size, flip_x, flip_y);
+	render_draw_rotated(dst_pos, vec2(tile_size.x, tile_size.y), pivot, sin, cos, img->texture, uv, color);
 }
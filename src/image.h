@@ -8,12 +8,32 @@
 // from it.
 
 #include "types.h"
+#include "render.h"
 
 // The maximum number of images we expect to have loaded at one time
 #if !defined(IMAGE_MAX_SOURCES)
 	#define IMAGE_MAX_SOURCES 1024
 #endif
 
+// The max number of threads used by images_load() to decode images
+#if !defined(IMAGE_DECODE_THREADS)
+	#define IMAGE_DECODE_THREADS 4
+#endif
+
+// The temp memory for files and pixels that images_load() uses before it waits
+// for all images in flight to be uploaded, so that it can free it again
+#if !defined(IMAGE_DECODE_MEMORY)
+	#define IMAGE_DECODE_MEMORY (8 * 1024 * 1024)
+#endif
+
+// The max number of precomputed tile uv rects for all loaded images. Each 
+// image gets a table for the first tile size it is drawn with. Drawing tiles 
+// with another size or from images that did not fit computes their uvs on 
+// each draw instead.
+#if !defined(IMAGE_TILE_UVS_MAX)
+	#define IMAGE_TILE_UVS_MAX (16 * 1024)
+#endif
+
 typedef struct image_t image_t;
 
 // Create an image with an array of size.x * size.y pixels
@@ -23,9 +43,29 @@ image_t *image_with_pixels(vec2i_t size, rgba_t *pixels);
 // same path will return the same, cached image instance.
 image_t *image(char *path);
 
+// Load many images at once and store them in loaded, if not NULL. The images
+// are decoded concurrently on IMAGE_DECODE_THREADS threads, while the next 
+// files are read and the decoded images are uploaded. Images that are already 
+// loaded are taken from the cache, same as with image().
+void images_load(char **paths, uint32_t len, image_t **loaded);
+
+// Decode the image at path again and replace the pixels of the already loaded
+// image in place. The size of the image must not change. Returns false if no
+// image with this path is loaded or it could not be reloaded. This is used by
+// the engine for PLATFORM_HOT_RELOAD and may be called during gameplay.
+bool image_reload(char *path);
+
 // Return the size of an image
 vec2i_t image_size(image_t *img);
 
+// Return the texture of an image
+texture_t image_texture(image_t *img);
+
+// Return the table of uv rects for all tiles of tile_size in the image, in 
+// the render backend's uv space, and its length in len. The table is built 
+// on first use. Returns NULL if the image has no table for this tile size.
+render_uv_rect_t *image_tile_uvs(image_t *img, vec2i_t tile_size, uint32_t *len);
+
 // Draw the whole image at pos
 void image_draw(image_t *img, vec2_t pos);
 
@@ -38,9 +78,17 @@ void image_draw_tile(image_t *img, uint32_t tile, vec2i_t tile_size, vec2_t dst_
 // Draw a single tile and specify x/y flipping and a tint color
 void image_draw_tile_ex(image_t *img, uint32_t tile, vec2i_t tile_size, vec2_t dst_pos, bool flip_x, bool flip_y, rgba_t color);
 
+// Draw a single tile, rotated around dst_pos + pivot by the angle whose sin
+// and cos are given; see render_draw_rotated()
+void image_draw_tile_rotated(image_t *img, uint32_t tile, vec2i_t tile_size, vec2_t dst_pos, vec2_t pivot, float sin, float cos, bool flip_x, bool flip_y, rgba_t color);
+
 // Called by the engine to manage image memory
-typedef struct { uint32_t index; } image_mark_t;
+typedef struct { uint32_t index; uint32_t tile_uvs_len; } image_mark_t;
 image_mark_t images_mark(void);
 void images_reset(image_mark_t mark);
 
+// Called by the engine to set up the decode threads for images_load(). The 
+// threads themselves are only started by the first images_load().
+void images_init(void);
+
 #endif
@@ -0,0 +1,90 @@
+#ifndef HI_LEVEL_H
+#define HI_LEVEL_H
+
+// The binary level format, as produced by libs/levelconv.c from Weltmeister 
+// json levels and loaded by engine_load_level(). All numbers are stored little
+// endian. All offsets are in bytes from the start of the file, and all
+// sections start at a 4 byte boundary; the settings section at an 8 byte 
+// boundary.
+
+// The file starts with a level_header_t, followed by the sections it points to:
+//   - a string table of NULL terminated strings; offset 0 in this table is
+//     always the empty string
+//   - maps_len level_map_t structs, each pointing to its width * height 
+//     uint16_t tiles with the same +1 bias as in json
+//   - types_len uint32_t string offsets with the names of all entity types
+//     used in this level
+//   - entities_len level_entity_t structs
+//   - the entity_settings_t blobs, each starting at an 8 byte boundary
+
+// Entity types are stored by name, since the type ids depend on the order of
+// ENTITY_TYPES in the game. They are resolved once per level, not per entity.
+// The entity settings are stored as entity_settings_t blobs, which are used in
+// place by the engine. An entity's name is its "name" setting.
+
+#include <stdint.h>
+
+#define LEVEL_MAGIC 0x766c6968 // "hilv"
+#define LEVEL_VERSION 3
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t strings_offset;
+	uint32_t strings_size;
+	uint32_t maps_offset;
+	uint32_t maps_len;
+	uint32_t types_offset;
+	uint32_t types_len;
+	uint32_t entities_offset;
+	uint32_t entities_len;
+	uint32_t settings_offset;
+	uint32_t settings_size;
+} level_header_t;
+
+typedef struct {
+	uint32_t name;
+	uint32_t tileset_name;
+	uint32_t data_offset;
+	uint16_t width;
+	uint16_t height;
+	uint16_t tile_size;
+	uint16_t max_tile;
+	float distance;
+	uint8_t repeat;
+	uint8_t foreground;
+	uint16_t padding;
+} level_map_t;
+
+typedef struct {
+	float x;
+	float y;
+	uint32_t type;
+	uint32_t settings;
+} level_entity_t;
+
+
+// Entity settings are a self contained blob: an open addressing hash table of 
+// capacity slots, followed by the string data. Keys are only stored as their 
+// str_hash() and looked up by probing from slot (hash & (capacity - 1)). The
+// same layout is built at load time for json levels, see 
+// entity_settings_from_json().
+
+// The type of empty slots
+#define LEVEL_SETTING_EMPTY 0xffffffff
+
+typedef struct {
+	uint64_t hash;
+	uint32_t type;    // json_type_t of the value
+	uint32_t offset;  // for strings and compact json text of arrays and 
+	                  // objects; from the start of the blob
+	double number;
+} entity_setting_t;
+
+struct entity_settings_t {
+	uint32_t size;     // in bytes, including this header
+	uint32_t capacity; // a power of two, at least twice the number of keys
+	entity_setting_t slots[];
+};
+
+#endif
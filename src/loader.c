@@ -0,0 +1,328 @@
+#include <string.h>
+#include "loader.h"
+#include "alloc.h"
+#include "utils.h"
+#include "platform.h"
+#include "sound.h"
+#include "level.h"
+
+#include "../libs/qoi.h"
+#include "../libs/qoa.h"
+
+typedef enum {
+	LOADER_TYPE_IMAGE,
+	LOADER_TYPE_SOUND,
+	LOADER_TYPE_JSON,
+	LOADER_TYPE_LEVEL,
+} loader_type_t;
+
+typedef struct {
+	loader_type_t type;
+	bool done;
+	uint32_t generation;
+	char path[PLATFORM_MAX_PATH];
+
+	// The decoded data for images and json, or the QOA file for sounds; for
+	// levels (and binary levels queued with loader_json()) the file itself
+	void *data;
+	bool is_level;
+	uint32_t len;
+	vec2i_t size;
+	int16_t *pcm_samples;
+} loader_job_t;
+
+// Jobs live in a ring buffer and are addressed by ever increasing indices. 
+// Each job belongs to the generation that was current when it was queued; a
+// new generation is started before each scene's init(). After init(), the 
+// jobs of the scene's generation are released, while the jobs queued for the
+// next scene are kept. The two live generations decode into separate arenas.
+static loader_job_t jobs[LOADER_JOBS_MAX];
+static uint32_t jobs_first = 0;
+static uint32_t jobs_generation_first = 0;
+static uint32_t jobs_done = 0;
+static uint32_t jobs_end = 0;
+static uint32_t generation = 0;
+static bool processing = false;
+
+static alloc_arena_t *arenas[2] = {NULL, NULL};
+static bool has_thread = false;
+static platform_mutex_t *mutex;
+static platform_cond_t *cond_queued;
+static platform_cond_t *cond_done;
+
+static void loader_process(loader_job_t *job) {
+	uint32_t file_size;
+	uint8_t *data = (uint8_t *)platform_map_asset(job->path, &file_size);
+	bool mapped = (data != NULL);
+	if (!mapped) {
+		data = platform_load_asset(job->path, &file_size);
+		error_if(data == NULL, "Failed to load %s", job->path);
+	}
+
+	switch (job->type) {
+		case LOADER_TYPE_IMAGE: {
+			qoi_desc desc;
+			rgba_t *pixels = qoi_decode(data, file_size, &desc, 4);
+			error_if(pixels == NULL, "Failed to decode image: %s", job->path);
+			if (!mapped) {
+				temp_free(data);
+			}
+
+			job->size = vec2i(desc.width, desc.height);
+			job->len = desc.width * desc.height * sizeof(rgba_t);
+			job->data = bump_from_temp(pixels, 0, job->len);
+			break;
+		}
+
+		case LOADER_TYPE_SOUND: {
+			// Short sounds are completely decoded, as with sound_source(); for
+			// longer ones we just keep the file.
+			qoa_desc desc;
+			uint32_t read_pos = qoa_decode_header(data, file_size, &desc);
+			error_if(read_pos == 0, "Failed to decode sound %s", job->path);
+
+			uint32_t total_samples = desc.samples * desc.channels;
+			if (total_samples <= SOUND_MAX_UNCOMPRESSED_SAMPLES) {
+				job->pcm_samples = bump_alloc_uninit(total_samples * sizeof(int16_t));
+				uint32_t sample_index = 0;
+				uint32_t frame_len;
+				uint32_t frame_size;
+				do {
+					int16_t *sample_ptr = job->pcm_samples + sample_index * desc.channels;
+					frame_size = qoa_decode_frame(data + read_pos, file_size - read_pos, &desc, sample_ptr, &frame_len);
+					error_if(frame_size == 0, "QOA decode error for file %s", job->path);
+
+					read_pos += frame_size;
+					sample_index += frame_len;
+				} while (frame_size && sample_index < desc.samples);
+			}
+
+			job->len = file_size;
+			job->data = mapped ? data : bump_from_temp(data, 0, file_size);
+			break;
+		}
+
+		case LOADER_TYPE_JSON: {
+			// Levels may have been converted to the binary format; these are
+			// kept as they are for engine_load_level()
+			if (file_size >= sizeof(level_header_t) && ((level_header_t *)data)->magic == LEVEL_MAGIC) {
+				job->is_level = true;
+				job->len = file_size;
+				job->data = mapped ? data : bump_from_temp(data, 0, file_size);
+				break;
+			}
+
+			job->data = json_parse_bump(data, file_size);
+			error_if(job->data == NULL, "Failed to parse json %s", job->path);
+			if (!mapped) {
+				temp_free(data);
+			}
+			break;
+		}
+
+		case LOADER_TYPE_LEVEL: {
+			// Levels are read by engine_load_level() straight from the file, 
+			// so we only have to get it into memory
+			job->is_level = true;
+			job->len = file_size;
+			job->data = mapped ? data : bump_from_temp(data, 0, file_size);
+			break;
+		}
+	}
+}
+
+static void loader_thread(void *data) {
+	platform_mutex_lock(mutex);
+	while (true) {
+		while (jobs_done == jobs_end) {
+			platform_cond_wait(cond_queued, mutex);
+		}
+
+		// Jobs are not released while they are processed, so we can process 
+		// this one without holding the lock.
+		loader_job_t *job = &jobs[jobs_done % LOADER_JOBS_MAX];
+		processing = true;
+		platform_mutex_unlock(mutex);
+
+		alloc_arena_bind(arenas[job->generation & 1]);
+		loader_process(job);
+		temp_alloc_check();
+
+		platform_mutex_lock(mutex);
+		job->done = true;
+		jobs_done = max(jobs_done + 1, jobs_first); // skip released jobs
+		processing = false;
+		platform_cond_broadcast(cond_done);
+	}
+}
+
+void loader_init(uint32_t arena_size) {
+	error_if(arenas[0], "Loader already initialized");
+	arenas[0] = alloc_arena(arena_size / 2, false);
+	arenas[1] = alloc_arena(arena_size / 2, false);
+	mutex = platform_mutex_create();
+	cond_queued = platform_cond_create();
+	cond_done = platform_cond_create();
+	has_thread = platform_thread_create(loader_thread, NULL);
+	if (!has_thread) {
+		printf("Failed to create loader thread; assets will load on demand\n");
+	}
+}
+
+static void loader_queue(loader_type_t type, char *path) {
+	if (!arenas[0]) {
+		return;
+	}
+	error_if(strlen(path) >= PLATFORM_MAX_PATH, "Path %s exceeds PLATFORM_MAX_PATH", path);
+
+	// Jobs of the previous generation are released after the current scene's
+	// init(), so only the current generation counts as already queued
+	platform_mutex_lock(mutex);
+	for (uint32_t i = jobs_generation_first; i < jobs_end; i++) {
+		loader_job_t *job = &jobs[i % LOADER_JOBS_MAX];
+		if (job->type == type && str_equals(job->path, path)) {
+			platform_mutex_unlock(mutex);
+			return;
+		}
+	}
+
+	error_if(jobs_end - jobs_first >= LOADER_JOBS_MAX, "LOADER_JOBS_MAX (%d) reached", LOADER_JOBS_MAX);
+	loader_job_t *job = &jobs[jobs_end % LOADER_JOBS_MAX];
+	*job = (loader_job_t){.type = type, .generation = generation};
+	strcpy(job->path, path);
+	jobs_end++;
+
+	platform_cond_broadcast(cond_queued);
+	platform_mutex_unlock(mutex);
+}
+
+void loader_image(char *path) {
+	loader_queue(LOADER_TYPE_IMAGE, path);
+}
+
+void loader_sound(char *path) {
+	loader_queue(LOADER_TYPE_SOUND, path);
+}
+
+void loader_json(char *path) {
+	loader_queue(LOADER_TYPE_JSON, path);
+}
+
+void loader_level(char *path) {
+	loader_queue(LOADER_TYPE_LEVEL, path);
+}
+
+float loader_progress(void) {
+	if (!has_thread) {
+		return 1;
+	}
+	platform_mutex_lock(mutex);
+	uint32_t jobs_len = jobs_end - jobs_first;
+	float progress = jobs_len ? (float)(jobs_done - jobs_first) / (float)jobs_len : 1;
+	platform_mutex_unlock(mutex);
+	return progress;
+}
+
+bool loader_done(void) {
+	return loader_progress() >= 1;
+}
+
+static loader_job_t *loader_take(loader_type_t type, char *path) {
+	if (!arenas[0]) {
+		return NULL;
+	}
+
+	platform_mutex_lock(mutex);
+	loader_job_t *job = NULL;
+	for (uint32_t i = jobs_first; i < jobs_end; i++) {
+		if (jobs[i % LOADER_JOBS_MAX].type == type && str_equals(jobs[i % LOADER_JOBS_MAX].path, path)) {
+			job = &jobs[i % LOADER_JOBS_MAX];
+			break;
+		}
+	}
+
+	if (job && has_thread) {
+		while (!job->done) {
+			platform_cond_wait(cond_done, mutex);
+		}
+	}
+	platform_mutex_unlock(mutex);
+
+	// Without a loader thread we process the job right here
+	if (job && !job->done) {
+		alloc_arena_t *prev_arena = alloc_arena_bound();
+		alloc_arena_bind(arenas[job->generation & 1]);
+		loader_process(job);
+		alloc_arena_bind(prev_arena);
+		job->done = true;
+	}
+	return job;
+}
+
+rgba_t *loader_take_image(char *path, vec2i_t *size) {
+	loader_job_t *job = loader_take(LOADER_TYPE_IMAGE, path);
+	if (!job) {
+		return NULL;
+	}
+	*size = job->size;
+	return job->data;
+}
+
+uint8_t *loader_take_sound(char *path, uint32_t *len, int16_t **pcm_samples) {
+	loader_job_t *job = loader_take(LOADER_TYPE_SOUND, path);
+	if (!job) {
+		return NULL;
+	}
+	*len = job->len;
+	*pcm_samples = job->pcm_samples;
+	return job->data;
+}
+
+json_t *loader_take_json(char *path) {
+	loader_job_t *job = loader_take(LOADER_TYPE_JSON, path);
+	if (!job || job->is_level) {
+		return NULL;
+	}
+	return job->data;
+}
+
+uint8_t *loader_take_level(char *path, uint32_t *len) {
+	loader_job_t *job = loader_take(LOADER_TYPE_LEVEL, path);
+	if (!job) {
+		job = loader_take(LOADER_TYPE_JSON, path);
+	}
+	if (!job || !job->is_level) {
+		return NULL;
+	}
+	*len = job->len;
+	return job->data;
+}
+
+void loader_begin_scene(void) {
+	if (!arenas[0]) {
+		return;
+	}
+
+	platform_mutex_lock(mutex);
+	jobs_generation_first = jobs_end;
+	generation++;
+	platform_mutex_unlock(mutex);
+}
+
+void loader_reset(void) {
+	if (!arenas[0]) {
+		return;
+	}
+
+	// Release the jobs of the scene that was just initialized. If one of them
+	// is still being processed, we have to wait for it to leave the arena; the
+	// others that were not started yet are skipped.
+	platform_mutex_lock(mutex);
+	jobs_first = jobs_generation_first;
+	while (processing && jobs_done < jobs_first) {
+		platform_cond_wait(cond_done, mutex);
+	}
+	jobs_done = max(jobs_done, jobs_first);
+	alloc_arena_reset(arenas[(generation + 1) & 1]);
+	platform_mutex_unlock(mutex);
+}
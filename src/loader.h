@@ -0,0 +1,67 @@
+#ifndef HI_LOADER_H
+#define HI_LOADER_H
+
+// The loader reads and decodes images, sounds and json files on a background
+// thread, so that scenes can be prepared while the current scene is still 
+// running. Assets queued with loader_image(), loader_sound(), loader_json() or
+// loader_level() are picked up by the next calls to image(), sound_source() 
+// and engine_load_level() with the same path. These then only have to do the 
+// final step on the main thread: uploading the texture or copying the data to
+// bump memory. If an asset is still being decoded, they wait for it.
+
+// The decoded data lives in the loader's arena until the loader is reset. The
+// engine does this after each scene's init(): assets that were queued before
+// init() are then discarded, whether they were picked up or not. Assets that
+// were queued during init() are kept for the next scene.
+
+// Typically you queue the assets of the next scene in its preload() function
+// and call engine_preload_scene() while the current scene is still running.
+
+// Without a call to loader_init(), or on platforms without threads, queued 
+// assets are loaded when they are picked up.
+
+#include "types.h"
+#include "../libs/pl_json.h"
+
+// The max number of assets to be queued at a time
+#if !defined(LOADER_JOBS_MAX)
+	#define LOADER_JOBS_MAX 256
+#endif
+
+// Start the loader with an arena of arena_size bytes for all decoded data. This
+// must be called from main_init(). Half of the arena is used for the assets of
+// the scene being initialized, the other half for those queued for the next.
+void loader_init(uint32_t arena_size);
+
+// Queue an image (QOI), sound (QOA) or json file to be loaded in the background
+void loader_image(char *path);
+void loader_sound(char *path);
+void loader_json(char *path);
+
+// Queue a level (json or binary) for engine_load_level(). The file is only read,
+// not parsed, so that the level can be streamed into its final memory.
+void loader_level(char *path);
+
+// Return the fraction of queued assets that are loaded
+float loader_progress(void);
+
+// Whether all queued assets are loaded
+bool loader_done(void);
+
+// Called by image(), sound_source() and engine_load_level() to pick up queued
+// assets. These return NULL if the asset was not queued. The returned data 
+// lives in the loader's arena and must not be temp_free()d.
+rgba_t *loader_take_image(char *path, vec2i_t *size);
+uint8_t *loader_take_sound(char *path, uint32_t *len, int16_t **pcm_samples);
+json_t *loader_take_json(char *path);
+
+// Called by engine_load_level() to pick up the file of a level that was queued
+// with loader_level(), or of a binary level queued with loader_json(). Returns
+// NULL if the path was not queued as such.
+uint8_t *loader_take_level(char *path, uint32_t *len);
+
+// Called by the engine before and after a scene's init()
+void loader_begin_scene(void);
+void loader_reset(void);
+
+#endif
@@ -6,26 +6,32 @@
 #include "engine.h"
 
 struct map_anim_def_t {
+	map_anim_def_t *next;
 	float inv_frame_time;
+	uint16_t tile;
 	uint16_t sequence_len;
 	uint16_t sequence[];
 };
 
 map_t *map_with_data(uint16_t tile_size, vec2i_t size, uint16_t *data) {
 	error_if(engine_is_running(), "Cannot create map during gameplay");
+	alloc_tag_push(ALLOC_TAG_MAPS);
 
-	map_t *map = bump_alloc(sizeof(map_t));
+	map_t *map = bump_alloc_aligned(sizeof(map_t), 8);
 	map->size = size;
 	map->tile_size = tile_size;
 	map->distance = 1;
 	map->data = data ? data : bump_alloc(size.x * size.y * sizeof(uint16_t));
+
+	alloc_tag_pop();
 	return map;
 }
 
 map_t *map_from_json(json_t *def) {
 	error_if(engine_is_running(), "Cannot create map during gameplay");
+	alloc_tag_push(ALLOC_TAG_MAPS);
 
-	map_t *map = bump_alloc(sizeof(map_t));
+	map_t *map = bump_alloc_aligned(sizeof(map_t), 8);
 
 	map->size.x = json_number(json_value_for_key(def, "width"));
 	map->size.y = json_number(json_value_for_key(def, "height"));
@@ -51,17 +57,101 @@ map_t *map_from_json(json_t *def) {
 	error_if(data->type != JSON_ARRAY, "Map data is not an array");
 	error_if(data->len != map->size.y, "Map data height is %d expected %d", data->len, map->size.y);
 
-	map->data = bump_alloc(sizeof(uint16_t) * map->size.x * map->size.y);
+	map->data = bump_alloc_uninit(sizeof(uint16_t) * map->size.x * map->size.y);
 
 	int index = 0;
 	for (int y = 0; y < data->len; y++) {
 		json_t *row = json_value_at(data, y);
+		error_if(row->type != JSON_ARRAY || row->len != map->size.x, "Map data width in row %d is %d expected %d", y, row->len, map->size.x);
 		for (int x = 0; x < row->len; x++, index++) {
 			map->data[index] = json_number(json_value_at(row, x));
 			map->max_tile = max(map->max_tile, map->data[index]);
 		}
 	}	
 
+	alloc_tag_pop();
+	return map;
+}
+
+static void map_read_data(map_t *map, json_reader_t *r) {
+	map->data = bump_alloc_uninit(sizeof(uint16_t) * map->size.x * map->size.y);
+
+	int index = 0;
+	int y = 0;
+	json_read_array_begin(r);
+	for (; json_read_array_next(r); y++) {
+		error_if(y >= map->size.y, "Map data height exceeds %d", map->size.y);
+		int x = 0;
+		json_read_array_begin(r);
+		for (; json_read_array_next(r); x++, index++) {
+			error_if(x >= map->size.x, "Map data width in row %d exceeds %d", y, map->size.x);
+			map->data[index] = json_read_number(r);
+			map->max_tile = max(map->max_tile, map->data[index]);
+		}
+		error_if(x != map->size.x, "Map data width in row %d is %d expected %d", y, x, map->size.x);
+	}
+	error_if(y != map->size.y, "Map data height is %d expected %d", y, map->size.y);
+}
+
+map_t *map_from_json_reader(json_reader_t *r) {
+	error_if(engine_is_running(), "Cannot create map during gameplay");
+	alloc_tag_push(ALLOC_TAG_MAPS);
+
+	map_t *map = bump_alloc_aligned(sizeof(map_t), 8);
+	char tileset_name[256] = {0};
+	json_reader_t data = {0};
+	bool has_data = false;
+
+	char key[32];
+	json_read_object_begin(r);
+	while (json_read_object_next(r, key, sizeof(key))) {
+		if (str_equals(key, "width")) {
+			map->size.x = json_read_number(r);
+		}
+		else if (str_equals(key, "height")) {
+			map->size.y = json_read_number(r);
+		}
+		else if (str_equals(key, "tilesize")) {
+			map->tile_size = json_read_number(r);
+		}
+		else if (str_equals(key, "distance")) {
+			map->distance = json_read_number(r);
+		}
+		else if (str_equals(key, "foreground")) {
+			map->foreground = json_read_bool(r);
+		}
+		else if (str_equals(key, "repeat")) {
+			map->repeat = json_read_bool(r);
+		}
+		else if (str_equals(key, "name") && json_read_peek(r) == JSON_STRING) {
+			json_read_string(r, map->name, sizeof(map->name));
+		}
+		else if (str_equals(key, "tilesetName") && json_read_peek(r) == JSON_STRING) {
+			json_read_string(r, tileset_name, sizeof(tileset_name));
+		}
+		else if (str_equals(key, "data")) {
+			// The size may only be known after the data, so we remember where
+			// it is and read it once the whole object has been seen.
+			error_if(json_read_peek(r) != JSON_ARRAY, "Map data is not an array");
+			uint32_t span_len;
+			uint8_t *span = json_read_skip(r, &span_len);
+			data = json_reader(span, span_len);
+			has_data = true;
+		}
+		else {
+			json_read_skip(r, NULL);
+		}
+	}
+	error_if(map->distance == 0, "invalid distance for map");
+	error_if(!has_data, "Map has no data");
+
+	if (tileset_name[0]) {
+		map->tileset = image(tileset_name);
+	}
+
+	map_read_data(map, &data);
+
+	alloc_tag_pop();
 	return map;
 }
 
@@ -69,21 +159,54 @@ void map_set_anim_with_len(map_t *map, uint16_t tile, float frame_time, uint16_t
 	error_if(engine_is_running(), "Cannot set map animation during gameplay");
 	error_if(sequence_len == 0, "Map animation has empty sequence");
 
-	if (tile > map->max_tile) {
+	if (tile >= map->max_tile) {
 		return;
 	}
 
+	alloc_tag_push(ALLOC_TAG_MAPS);
 	if (!map->anims) {
-		map->anims = bump_alloc(sizeof(anim_def_t *) * map->max_tile);
+		map->anims = bump_alloc(sizeof(map_anim_def_t *) * map->max_tile);
+		map->anim_tiles = bump_alloc_uninit(sizeof(uint16_t) * map->max_tile);
+		for (int i = 0; i < map->max_tile; i++) {
+			map->anim_tiles[i] = i;
+		}
+		map->anim_tiles_time = -1;
 	}
 
 	map_anim_def_t *def = bump_alloc(sizeof(map_anim_def_t) + sizeof(uint16_t) * sequence_len);
+	alloc_tag_pop();
+
 	def->inv_frame_time = 1.0 / frame_time;
+	def->tile = tile;
 	def->sequence_len = sequence_len;
 	memcpy(def->sequence, sequence, sequence_len * sizeof(uint16_t));
+
+	// Replace an earlier animation for this tile
+	if (map->anims[tile]) {
+		for (map_anim_def_t **d = &map->anims_list; *d; d = &(*d)->next) {
+			if (*d == map->anims[tile]) {
+				*d = (*d)->next;
+				break;
+			}
+		}
+	}
+	def->next = map->anims_list;
+	map->anims_list = def;
 	map->anims[tile] = def;
 }
 
+// Set the current frame of all animated tiles, once per frame
+static inline void map_update_anim_tiles(map_t *map) {
+	if (!map->anim_tiles || map->anim_tiles_time == engine.time) {
+		return;
+	}
+	map->anim_tiles_time = engine.time;
+	for (map_anim_def_t *def = map->anims_list; def; def = def->next) {
+		int frame = (int)(engine.time * def->inv_frame_time) % def->sequence_len;
+		map->anim_tiles[def->tile] = def->sequence[frame];
+	}
+}
+
 int map_tile_at(map_t *map, vec2i_t tile_pos) {
 	if (
 		tile_pos.x < 0 || tile_pos.x >= map->size.x ||
@@ -103,19 +226,66 @@ int map_tile_at_px(map_t *map, vec2_t px_pos) {
 
 
 static inline void map_draw_tile(map_t *map, uint16_t tile, vec2_t pos) {
-	if (map->anims && map->anims[tile]) {
-		map_anim_def_t *def = map->anims[tile];
-		int frame = (int)(engine.time * def->inv_frame_time) % def->sequence_len;
-		tile = def->sequence[frame];
+	if (map->anim_tiles) {
+		tile = map->anim_tiles[tile];
 	}
 
 	image_draw_tile(map->tileset, tile, vec2i(map->tile_size, map->tile_size), pos);
 }
 
+// Draw the map through the render layer's tile emitter. Returns false if the
+// tileset has no uv table for this tile size.
+static bool map_draw_layer(map_t *map, vec2_t offset) {
+	int ts = map->tile_size;
+	render_tile_layer_t layer = {
+		.data = map->data,
+		.size = map->size,
+		.tile_size = ts,
+		.texture = image_texture(map->tileset),
+		.remap = map->anim_tiles
+	};
+	layer.tile_uvs = image_tile_uvs(map->tileset, vec2i(ts, ts), &layer.tile_uvs_len);
+	if (!layer.tile_uvs) {
+		return false;
+	}
+
+	vec2i_t rs = render_size();
+	if (map->repeat) {
+		// Same range as the generic path in map_draw()
+		vec2i_t tile_offset = vec2i_divi(vec2i_from_vec2(offset), ts);
+		vec2_t px_offset = vec2(fmodf(offset.x, ts), fmodf(offset.y, ts));
+		vec2i_t tile_min = vec2i(tile_offset.x - 1, tile_offset.y - 1);
+		vec2i_t tile_max = vec2i(
+			tile_min.x + (rs.x + 3 * ts - 1) / ts,
+			tile_min.y + (rs.y + 3 * ts - 1) / ts
+		);
+		vec2_t pos = vec2(-px_offset.x - ts, -px_offset.y - ts);
+		render_draw_tile_layer(&layer, tile_min, tile_max, pos, rgba_white());
+	}
+	else {
+		vec2i_t tile_min = vec2i(
+			max(0, offset.x / ts),
+			max(0, offset.y / ts)
+		);
+		vec2i_t tile_max = vec2i(
+			min(map->size.x, (offset.x + rs.x + ts) / ts),
+			min(map->size.y, (offset.y + rs.y + ts) / ts)
+		);
+		vec2_t pos = vec2_sub(vec2(tile_min.x * ts, tile_min.y * ts), offset);
+		render_draw_tile_layer(&layer, tile_min, tile_max, pos, rgba_white());
+	}
+	return true;
+}
+
 void map_draw(map_t *map, vec2_t offset) {
 	error_if(!map->tileset, "Cannot draw map without tileset");
 
 	offset = vec2_divf(offset, map->distance);
+	map_update_anim_tiles(map);
+	if (map_draw_layer(map, offset)) {
+		return;
+	}
+
 	vec2i_t rs = render_size();
 	int ts = map->tile_size;
 
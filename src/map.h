@@ -7,6 +7,7 @@
 
 #include "types.h"
 #include "../libs/pl_json.h"
+#include "utils.h"
 #include "image.h"
 #include "animation.h"
 
@@ -40,7 +41,19 @@ typedef struct {
 	// animations.
 	map_anim_def_t **anims;
 
-	// The tile indices with a length of size.x * size.y
+	// The tile to draw for each tile index, i.e. the current frame for 
+	// animated tiles. Updated once per frame; NULL if there are no 
+	// animations.
+	uint16_t *anim_tiles;
+	double anim_tiles_time;
+
+	// All animations of this map, for updating anim_tiles; used internally.
+	map_anim_def_t *anims_list;
+
+	// The tile indices with a length of size.x * size.y. Maps loaded by 
+	// engine_load_level() always own a writable copy in bump memory, even 
+	// for binary levels in the mapped (read only) asset archive, so games can
+	// change tiles at runtime.
 	uint16_t *data;
 
 	// The highest tile index in that map; used internally.
@@ -73,6 +86,11 @@ map_t *map_with_data(uint16_t tile_size, vec2i_t size, uint16_t *data);
 */
 map_t *map_from_json(json_t *def);
 
+// Create a map from the map object that is the next value of the json reader,
+// in the same format as map_from_json(). The tile data is written straight
+// into the map without building a json tree first.
+map_t *map_from_json_reader(json_reader_t *r);
+
 // Set the frame time and animation sequence for a particular tile. You can
 // only do this in your scene_init()
 #define map_set_anim(MAP, TILE, FRAME_TIME, ...) \
@@ -14,8 +14,8 @@ noise_t *noise(uint8_t size_bits) {
 	n->size_bits = size_bits;
 
 	uint16_t size = 1 << size_bits;
-	n->g = bump_alloc(sizeof(vec2_t) * size);
-	n->p = bump_alloc(sizeof(uint16_t *) * size);
+	n->g = bump_alloc_uninit(sizeof(vec2_t) * size);
+	n->p = bump_alloc_uninit(sizeof(uint16_t *) * size);
 
 	for (int i = 0; i < size; i++) {
 		n->g[i] = vec2(rand_float(-1, 1), rand_float(-1, 1));
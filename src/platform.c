@@ -17,8 +17,124 @@
 	#include <unistd.h>
 #endif
 
+// Dependencies for threads
+#if defined(_WIN32)
+	struct platform_mutex_t { SRWLOCK lock; };
+	struct platform_cond_t { CONDITION_VARIABLE cond; };
+	#define PLATFORM_MUTEX_INITIALIZER {SRWLOCK_INIT}
+#else
+	#include <pthread.h>
+	struct platform_mutex_t { pthread_mutex_t lock; };
+	struct platform_cond_t { pthread_cond_t cond; };
+	#define PLATFORM_MUTEX_INITIALIZER {PTHREAD_MUTEX_INITIALIZER}
+#endif
+
+// Dependencies for platform_map_asset()
+#if PLATFORM_MAP_ASSETS
+	#include <sys/mman.h>
+#endif
+
+// Dependencies for platform_changed_asset()
+#if PLATFORM_HOT_RELOAD && defined(__linux__)
+	#include <sys/inotify.h>
+	#include <dirent.h>
+#endif
+
+// Dependencies for compressed files in the QOP archive
+#define LZ4_BLOCK_IMPLEMENTATION
+#include "../libs/lz4_block.h"
+
+static platform_mutex_t asset_mutex = PLATFORM_MUTEX_INITIALIZER;
+static platform_mutex_t audio_mutex = PLATFORM_MUTEX_INITIALIZER;
+
+static uint8_t *platform_load_qop_file(qop_file *f, uint32_t *bytes_read) {
+	if (!(f->flags & QOP_FLAG_COMPRESSED_LZ4)) {
+		uint8_t *data = temp_alloc(f->size);
+		*bytes_read = qop_read(&qop, f, data);
+		return data;
+	}
+
+	// Allocate the destination first, so that the compressed data can be
+	// freed from the top of the temp memory.
+	uint8_t size_le[4];
+	error_if(f->size < 4 || qop_read_ex(&qop, f, size_le, 0, 4) != 4, "Failed to read compressed asset");
+	uint32_t size = size_le[0] | (size_le[1] << 8) | (size_le[2] << 16) | (size_le[3] << 24);
+	uint8_t *data = temp_alloc(size);
+
+	uint8_t *compressed = temp_alloc(f->size - 4);
+	uint32_t compressed_len = qop_read_ex(&qop, f, compressed, 4, f->size - 4);
+	int decompressed_len = lz4_block_decompress(compressed, compressed_len, data, size);
+	temp_free(compressed);
+
+	error_if(decompressed_len != size, "Failed to decompress asset");
+	*bytes_read = size;
+	return data;
+}
+
+uint8_t *platform_load_asset(const char *name, uint32_t *bytes_read) {
+	platform_mutex_lock(&asset_mutex);
+	uint8_t *data;
+
+	// Try to load from the QOP archive first
+	qop_file *f = qop.index_len ? qop_find(&qop, name) : NULL;
+	if (f) {
+		data = platform_load_qop_file(f, bytes_read);
+	}
+	else {
+		data = platform_load_asset_locked(name, bytes_read);
+	}
+
+	platform_mutex_unlock(&asset_mutex);
+	return data;
+}
+
+const uint8_t *platform_map_asset(const char *name, uint32_t *len) {
+	#if PLATFORM_MAP_ASSETS
+		static uint8_t *archive = NULL;
+		static bool archive_failed = false;
+
+		if (!qop.index_len) {
+			return NULL;
+		}
+
+		// Map the whole archive on first use
+		platform_mutex_lock(&asset_mutex);
+		if (!archive && !archive_failed) {
+			size_t size = qop.index_offset + qop.index_len * QOP_INDEX_SIZE + QOP_HEADER_SIZE;
+			void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(qop.fh), 0);
+			if (p == MAP_FAILED) {
+				printf("Failed to map QOP archive; falling back to reads\n");
+				archive_failed = true;
+			}
+			else {
+				archive = p;
+			}
+		}
+		platform_mutex_unlock(&asset_mutex);
+
+		if (!archive) {
+			return NULL;
+		}
+
+		// Compressed or encrypted files can't be used in place
+		qop_file *f = qop_find(&qop, name);
+		if (!f || f->flags != QOP_FLAG_NONE) {
+			return NULL;
+		}
+		*len = f->size;
+		return archive + qop.files_offset + f->offset + f->path_len;
+	#else
+		return NULL;
+	#endif
+}
+
 json_t *platform_load_asset_json(const char *name) {
 	uint32_t len;
+	const uint8_t *mapped = platform_map_asset(name, &len);
+	if (mapped) {
+		return json_parse((uint8_t *)mapped, len);
+	}
+
 	uint8_t *data = platform_load_asset(name, &len);
 	if (data == NULL) {
 		return NULL;
@@ -28,6 +144,129 @@ json_t *platform_load_asset_json(const char *name) {
 	return v;
 }
 
+#if PLATFORM_HOT_RELOAD && defined(__linux__)
+	#define PLATFORM_HOT_RELOAD_MAX_CHANGED 32
+
+	static int hot_reload_fd = -1;
+	static int hot_reload_wds[PLATFORM_HOT_RELOAD_MAX_DIRS];
+	static char hot_reload_dirs[PLATFORM_HOT_RELOAD_MAX_DIRS][PLATFORM_MAX_PATH];
+	static uint32_t hot_reload_dirs_len = 0;
+
+	// The changed files from the last read of all pending events; each file 
+	// is only listed once.
+	static char hot_reload_changed[PLATFORM_HOT_RELOAD_MAX_CHANGED][PLATFORM_MAX_PATH];
+	static uint32_t hot_reload_changed_len = 0;
+	static uint32_t hot_reload_changed_next = 0;
+
+	// Watch dir (relative to the asset path) and all its sub directories
+	static void platform_hot_reload_watch(const char *dir) {
+		if (hot_reload_dirs_len >= PLATFORM_HOT_RELOAD_MAX_DIRS) {
+			printf("Hot reload: max dirs (%d) reached; not watching %s\n", PLATFORM_HOT_RELOAD_MAX_DIRS, dir);
+			return;
+		}
+
+		char path[strlen(path_assets) + PLATFORM_MAX_PATH];
+		strcat(strcpy(path, path_assets), dir);
+		if (!path[0]) {
+			strcpy(path, ".");
+		}
+
+		int wd = inotify_add_watch(hot_reload_fd, path, IN_CLOSE_WRITE | IN_MOVED_TO);
+		if (wd < 0) {
+			return;
+		}
+		hot_reload_wds[hot_reload_dirs_len] = wd;
+		strcpy(hot_reload_dirs[hot_reload_dirs_len], dir);
+		hot_reload_dirs_len++;
+
+		DIR *d = opendir(path);
+		if (!d) {
+			return;
+		}
+		struct dirent *entry;
+		while ((entry = readdir(d))) {
+			if (entry->d_type == DT_DIR && entry->d_name[0] != '.') {
+				char sub_dir[PLATFORM_MAX_PATH];
+				snprintf(sub_dir, sizeof(sub_dir), "%s%s/", dir, entry->d_name);
+				platform_hot_reload_watch(sub_dir);
+			}
+		}
+		closedir(d);
+	}
+
+	static void platform_hot_reload_read_events(void) {
+		hot_reload_changed_len = 0;
+		hot_reload_changed_next = 0;
+
+		char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+		ssize_t len;
+		while ((len = read(hot_reload_fd, buffer, sizeof(buffer))) > 0) {
+			struct inotify_event *ev;
+			for (char *p = buffer; p < buffer + len; p += sizeof(struct inotify_event) + ev->len) {
+				ev = (struct inotify_event *)p;
+				if (!ev->len || (ev->mask & IN_ISDIR) || ev->name[0] == '.') {
+					continue;
+				}
+
+				char *dir = NULL;
+				for (uint32_t i = 0; i < hot_reload_dirs_len && !dir; i++) {
+					if (hot_reload_wds[i] == ev->wd) {
+						dir = hot_reload_dirs[i];
+					}
+				}
+				if (!dir) {
+					continue;
+				}
+
+				char name[PLATFORM_MAX_PATH];
+				snprintf(name, sizeof(name), "%s%s", dir, ev->name);
+
+				bool listed = false;
+				for (uint32_t i = 0; i < hot_reload_changed_len && !listed; i++) {
+					listed = str_equals(hot_reload_changed[i], name);
+				}
+				if (!listed && hot_reload_changed_len < PLATFORM_HOT_RELOAD_MAX_CHANGED) {
+					strcpy(hot_reload_changed[hot_reload_changed_len++], name);
+				}
+			}
+		}
+	}
+#endif
+
+char *platform_changed_asset(void) {
+	#if PLATFORM_HOT_RELOAD && defined(__linux__)
+		// Assets from the archive never change
+		if (qop.index_len) {
+			return NULL;
+		}
+
+		// Start watching on first use
+		if (hot_reload_fd == -1) {
+			hot_reload_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+			if (hot_reload_fd < 0) {
+				printf("Hot reload: failed to initialize inotify\n");
+				hot_reload_fd = -2;
+				return NULL;
+			}
+			platform_hot_reload_watch("");
+			printf("Hot reload: watching %d dirs in %s\n", hot_reload_dirs_len, path_assets[0] ? path_assets : ".");
+		}
+		if (hot_reload_fd < 0) {
+			return NULL;
+		}
+
+		if (hot_reload_changed_next == hot_reload_changed_len) {
+			platform_hot_reload_read_events();
+		}
+		if (hot_reload_changed_next < hot_reload_changed_len) {
+			return hot_reload_changed[hot_reload_changed_next++];
+		}
+		return NULL;
+	#else
+		return NULL;
+	#endif
+}
+
 char *platform_executable_path(void) {
 	uint32_t buffer_len = 2048;
 	char buffer[buffer_len];
@@ -65,3 +304,113 @@ char *platform_dirname(char *path) {
 	}
 	return str_format("%.*s", last_slash - path + 1, path);
 }
+
+
+
+// Threads ---------------------------------------------------------------------
+
+typedef struct {
+	void (*func)(void *data);
+	void *data;
+} platform_thread_start_t;
+
+#if defined(_WIN32)
+	static DWORD WINAPI platform_thread_main(LPVOID param) {
+		platform_thread_start_t start = *(platform_thread_start_t *)param;
+		free(param);
+		start.func(start.data);
+		return 0;
+	}
+#else
+	static void *platform_thread_main(void *param) {
+		platform_thread_start_t start = *(platform_thread_start_t *)param;
+		free(param);
+		start.func(start.data);
+		return NULL;
+	}
+#endif
+
+bool platform_thread_create(void (*func)(void *data), void *data) {
+	// The start params are handed over to the thread, which may outlive any
+	// of our bump memory, so we malloc() them.
+	platform_thread_start_t *start = malloc(sizeof(platform_thread_start_t));
+	start->func = func;
+	start->data = data;
+
+	#if defined(_WIN32)
+		HANDLE thread = CreateThread(NULL, 0, platform_thread_main, start, 0, NULL);
+		if (thread == NULL) {
+			free(start);
+			return false;
+		}
+		CloseHandle(thread);
+	#else
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, platform_thread_main, start) != 0) {
+			free(start);
+			return false;
+		}
+		pthread_detach(thread);
+	#endif
+	return true;
+}
+
+platform_mutex_t *platform_mutex_create(void) {
+	platform_mutex_t *mutex = bump_alloc(sizeof(platform_mutex_t));
+	#if defined(_WIN32)
+		InitializeSRWLock(&mutex->lock);
+	#else
+		pthread_mutex_init(&mutex->lock, NULL);
+	#endif
+	return mutex;
+}
+
+void platform_mutex_lock(platform_mutex_t *mutex) {
+	#if defined(_WIN32)
+		AcquireSRWLockExclusive(&mutex->lock);
+	#else
+		pthread_mutex_lock(&mutex->lock);
+	#endif
+}
+
+void platform_mutex_unlock(platform_mutex_t *mutex) {
+	#if defined(_WIN32)
+		ReleaseSRWLockExclusive(&mutex->lock);
+	#else
+		pthread_mutex_unlock(&mutex->lock);
+	#endif
+}
+
+void platform_audio_lock(void) {
+	platform_mutex_lock(&audio_mutex);
+}
+
+void platform_audio_unlock(void) {
+	platform_mutex_unlock(&audio_mutex);
+}
+
+platform_cond_t *platform_cond_create(void) {
+	platform_cond_t *cond = bump_alloc(sizeof(platform_cond_t));
+	#if defined(_WIN32)
+		InitializeConditionVariable(&cond->cond);
+	#else
+		pthread_cond_init(&cond->cond, NULL);
+	#endif
+	return cond;
+}
+
+void platform_cond_wait(platform_cond_t *cond, platform_mutex_t *mutex) {
+	#if defined(_WIN32)
+		SleepConditionVariableSRW(&cond->cond, &mutex->lock, INFINITE, 0);
+	#else
+		pthread_cond_wait(&cond->cond, &mutex->lock);
+	#endif
+}
+
+void platform_cond_broadcast(platform_cond_t *cond) {
+	#if defined(_WIN32)
+		WakeAllConditionVariable(&cond->cond);
+	#else
+		pthread_cond_broadcast(&cond->cond);
+	#endif
+}
@@ -38,6 +38,30 @@
 #endif
 
 
+// Whether to memory map the QOP archive for platform_map_asset(). Only
+// supported on Linux and macOS.
+#if !defined(PLATFORM_MAP_ASSETS)
+	#if defined(__linux__) || defined(__APPLE__)
+		#define PLATFORM_MAP_ASSETS 1
+	#else
+		#define PLATFORM_MAP_ASSETS 0
+	#endif
+#endif
+
+// Whether to watch the asset directory for changed files, so that they can be
+// reloaded while the game is running. This is meant for development builds 
+// and only supported on Linux (inotify). It has no effect when the assets are
+// loaded from a QOP archive.
+#if !defined(PLATFORM_HOT_RELOAD)
+	#define PLATFORM_HOT_RELOAD 0
+#endif
+
+// The max number of directories in the asset tree that are watched for 
+// PLATFORM_HOT_RELOAD
+#if !defined(PLATFORM_HOT_RELOAD_MAX_DIRS)
+	#define PLATFORM_HOT_RELOAD_MAX_DIRS 64
+#endif
+
 // The max path length when loading/storing files
 #if !defined(PLATFORM_MAX_PATH)
 	#define PLATFORM_MAX_PATH 512
@@ -58,12 +82,29 @@ void platform_set_fullscreen(bool fullscreen);
 // Returns the samplerate of the audio output
 uint32_t platform_samplerate(void);
 
-// Load a file into temp memory. Must be freed via temp_free()
+// Load a file into temp memory. Must be freed via temp_free(). Compressed 
+// files in the QOP archive are decompressed. This may be called from any 
+// thread; loads are serialized.
 uint8_t *platform_load_asset(const char *name, uint32_t *bytes_read);
 
+// Return a pointer to the contents of an asset in the QOP archive that is
+// appended to the executable, without copying. The archive is memory mapped
+// on first use and stays mapped until the program ends. The memory is read 
+// only. Returns NULL if there's no archive, the file is not in the archive or
+// compressed, or if memory mapping is not supported; use platform_load_asset()
+// in this case.
+const uint8_t *platform_map_asset(const char *name, uint32_t *len);
+
 // Load a json file into temp memory. Must be freed via temp_free()
 json_t *platform_load_asset_json(const char *name);
 
+// Return the name of the next asset that was written since the last call, or
+// NULL if there are no more changes. Call this repeatedly until it returns 
+// NULL; a file that was written multiple times in between is reported only 
+// once. The name is valid until then. Always returns NULL without 
+// PLATFORM_HOT_RELOAD.
+char *platform_changed_asset(void);
+
 // Return the path to the current executable, bump allocated. Returns NULL
 // on failure.
 char *platform_executable_path(void);
@@ -85,6 +126,31 @@ void platform_exit(void);
 // Sets the audio mix callback; done by the engine
 void platform_set_audio_mix_cb(void (*cb)(float *buffer, uint32_t len));
 
+// Lock out the audio mix callback, e.g. to replace sound data it may read.
+// The callback only runs with this lock held with PLATFORM_HOT_RELOAD, so 
+// that release builds keep the audio thread lock-free. Keep the time between
+// lock and unlock short.
+void platform_audio_lock(void);
+void platform_audio_unlock(void);
+
+
+// Threads. The thread runs func(data) and is never joined. Returns false if
+// the thread could not be created, e.g. on the web without thread support.
+bool platform_thread_create(void (*func)(void *data), void *data);
+
+// Mutexes and condition variables for threads. These are bump allocated, so
+// they should be created in main_init().
+typedef struct platform_mutex_t platform_mutex_t;
+typedef struct platform_cond_t platform_cond_t;
+
+platform_mutex_t *platform_mutex_create(void);
+void platform_mutex_lock(platform_mutex_t *mutex);
+void platform_mutex_unlock(platform_mutex_t *mutex);
+
+platform_cond_t *platform_cond_create(void);
+void platform_cond_wait(platform_cond_t *cond, platform_mutex_t *mutex);
+void platform_cond_broadcast(platform_cond_t *cond);
+
 #if defined(RENDER_SOFTWARE)
 	rgba_t *platform_get_screenbuffer(int32_t *pitch);
 #endif
@@ -253,7 +253,13 @@ uint32_t platform_samplerate(void) {
 
 void platform_audio_callback(float* buffer, int num_frames, int num_channels) {
 	if (audio_callback) {
-		audio_callback(buffer, num_frames * num_channels);
+		#if PLATFORM_HOT_RELOAD
+			platform_audio_lock();
+			audio_callback(buffer, num_frames * num_channels);
+			platform_audio_unlock();
+		#else
+			audio_callback(buffer, num_frames * num_channels);
+		#endif
 	}
 	else {
 		memset(buffer, 0, num_frames * sizeof(float));
@@ -264,18 +270,12 @@ void platform_set_audio_mix_cb(void (*cb)(float *buffer, uint32_t len)) {
 	audio_callback = cb;
 }
 
-uint8_t *platform_load_asset(const char *name, uint32_t *bytes_read) {
-	// Try to load from the QOP archive first
-	if (qop.index_len) {
-		qop_file *f = qop_find(&qop, name);
-		if (f) {
-			uint8_t *data = temp_alloc(f->size);
-			*bytes_read = qop_read(&qop, f, data);
-			return data;
-		}
-	}
-
-	char *path = strcat(strcpy(temp_path, path_assets), name);
+// Called by platform_load_asset() with the asset mutex held, for assets that
+// are not in the QOP archive. This may run on any thread, so we can't use the
+// shared temp_path here.
+static uint8_t *platform_load_asset_locked(const char *name, uint32_t *bytes_read) {
+	char path[strlen(path_assets) + PLATFORM_MAX_PATH];
+	strcat(strcpy(path, path_assets), name);
 	return file_load(path, bytes_read);
 }
 
@@ -110,38 +110,41 @@ vec2_t render_snap_px(vec2_t pos) {
 	return vec2_mulf(vec2(round(sp.x), round(sp.y)), inv_screen_scale);
 }
 
-void render_draw(vec2_t pos, vec2_t size, texture_t texture_handle, vec2_t uv_offset, vec2_t uv_size, rgba_t color) {
+// Set up the quad for a rect with the given logical position and size and the
+// uv coords of its top left and bottom right corner. Returns false if the rect
+// is off screen.
+static inline bool render_rect_quad(quadverts_t *q, vec2_t pos, vec2_t size, vec2_t uv_tl, vec2_t uv_br, rgba_t color) {
 	if (
 		pos.x > logical_size.x || pos.y > logical_size.y ||
 		pos.x + size.x < 0     || pos.y + size.y < 0
 	) {
-		return;
+		return false;
 	}
 
 	pos = vec2_mulf(pos, screen_scale);
 	size = vec2_mulf(size, screen_scale);
 	draw_calls++;
 
-	quadverts_t q = {
+	*q = (quadverts_t){
 		.vertices = {
 			{
 				.pos = {pos.x, pos.y},
-				.uv = {uv_offset.x , uv_offset.y},
+				.uv = {uv_tl.x, uv_tl.y},
 				.color = color
 			},
 			{
 				.pos = {pos.x + size.x, pos.y},
-				.uv = {uv_offset.x +  uv_size.x, uv_offset.y},
+				.uv = {uv_br.x, uv_tl.y},
 				.color = color
 			},
 			{
 				.pos = {pos.x + size.x, pos.y + size.y},
-				.uv = {uv_offset.x + uv_size.x, uv_offset.y + uv_size.y},
+				.uv = {uv_br.x, uv_br.y},
 				.color = color
 			},
 			{
 				.pos = {pos.x, pos.y + size.y},
-				.uv = {uv_offset.x, uv_offset.y + uv_size.y},
+				.uv = {uv_tl.x, uv_br.y},
 				.color = color
 			}
 		}
@@ -150,9 +153,155 @@ void render_draw(vec2_t pos, vec2_t size, texture_t texture_handle, vec2_t uv_of
 	if (transform_stack_index > 0) {
 		mat3_t *m = &transform_stack[transform_stack_index];
 		for (uint32_t i = 0; i < 4; i++) {
-			q.vertices[i].pos = vec2_transform(q.vertices[i].pos, m);
+			q->vertices[i].pos = vec2_transform(q->vertices[i].pos, m);
+		}
+	}
+	return true;
+}
+
+void render_draw(vec2_t pos, vec2_t size, texture_t texture_handle, vec2_t uv_offset, vec2_t uv_size, rgba_t color) {
+	quadverts_t q;
+	if (render_rect_quad(&q, pos, size, uv_offset, vec2_add(uv_offset, uv_size), color)) {
+		render_draw_quad(&q, texture_handle);
+	}
+}
+
+void render_draw_uv_rect(vec2_t pos, vec2_t size, texture_t texture_handle, render_uv_rect_t uv, rgba_t color) {
+	quadverts_t q;
+	if (render_rect_quad(&q, pos, size, uv.tl, uv.br, color)) {
+		render_draw_quad_uv_final(&q, texture_handle);
+	}
+}
+
+void render_draw_rotated(vec2_t pos, vec2_t size, vec2_t pivot, float sin, float cos, texture_t texture_handle, render_uv_rect_t uv, rgba_t color) {
+	// Without a transform, skip rects whose bounding circle around the pivot
+	// is off screen
+	vec2_t center = vec2_add(pos, pivot);
+	if (transform_stack_index == 0) {
+		vec2_t extent = vec2(max(pivot.x, size.x - pivot.x), max(pivot.y, size.y - pivot.y));
+		float r = vec2_len(extent);
+		if (
+			center.x - r > logical_size.x || center.y - r > logical_size.y ||
+			center.x + r < 0              || center.y + r < 0
+		) {
+			return;
 		}
 	}
 
-	render_draw_quad(&q, texture_handle);
+	mat3_t m = transform_stack[transform_stack_index];
+	mat3_translate(&m, vec2_mulf(center, screen_scale));
+	mat3_rotate_sin_cos(&m, sin, cos);
+
+	vec2_t tl = vec2_mulf(pivot, -screen_scale);
+	vec2_t br = vec2_add(tl, vec2_mulf(size, screen_scale));
+	draw_calls++;
+
+	quadverts_t q = {
+		.vertices = {
+			{.pos = vec2_transform(vec2(tl.x, tl.y), &m), .uv = {uv.tl.x, uv.tl.y}, .color = color},
+			{.pos = vec2_transform(vec2(br.x, tl.y), &m), .uv = {uv.br.x, uv.tl.y}, .color = color},
+			{.pos = vec2_transform(vec2(br.x, br.y), &m), .uv = {uv.br.x, uv.br.y}, .color = color},
+			{.pos = vec2_transform(vec2(tl.x, br.y), &m), .uv = {uv.tl.x, uv.br.y}, .color = color}
+		}
+	};
+	render_draw_quad_uv_final(&q, texture_handle);
+}
+
+void render_draw_quads(quadverts_t *quads, uint32_t len, texture_t texture_handle, vec2_t offset) {
+	mat3_t *m = transform_stack_index > 0 ? &transform_stack[transform_stack_index] : NULL;
+
+	for (uint32_t i = 0; i < len;) {
+		uint32_t reserved;
+		quadverts_t *q = render_reserve_quads(len - i, &reserved);
+		memcpy(q, quads + i, reserved * sizeof(quadverts_t));
+
+		for (uint32_t j = 0; j < reserved; j++) {
+			for (uint32_t k = 0; k < 4; k++) {
+				vec2_t *p = &q[j].vertices[k].pos;
+				*p = vec2_mulf(vec2_add(*p, offset), screen_scale);
+				if (m) {
+					*p = vec2_transform(*p, m);
+				}
+			}
+		}
+
+		render_commit_quads(reserved, texture_handle);
+		draw_calls += reserved;
+		i += reserved;
+	}
+}
+
+// Write one row of a tile layer into the render buffer. This is inlined once
+// with and once without remap, so that layers without animated tiles don't 
+// pay for the lookup.
+static inline void render_tile_layer_row(
+	render_tile_layer_t *layer, uint16_t *row, int map_x, uint32_t cols, 
+	vec2_t pos, float ts, mat3_t *m, rgba_t color, bool remap
+) {
+	for (uint32_t col = 0; col < cols;) {
+		uint32_t reserved;
+		quadverts_t *q = render_reserve_quads(cols - col, &reserved);
+		uint32_t written = 0;
+
+		for (uint32_t end = col + reserved; col < end; col++, pos.x += ts) {
+			uint32_t tile = row[map_x];
+			if (++map_x == layer->size.x) {
+				map_x = 0;
+			}
+			if (tile == 0) {
+				continue;
+			}
+			tile--;
+			if (remap) {
+				tile = layer->remap[tile];
+			}
+			if (tile >= layer->tile_uvs_len) {
+				continue;
+			}
+
+			render_uv_rect_t *uv = &layer->tile_uvs[tile];
+			vertex_t *v = q[written++].vertices;
+			v[0] = (vertex_t){.pos = {pos.x,      pos.y},      .uv = {uv->tl.x, uv->tl.y}, .color = color};
+			v[1] = (vertex_t){.pos = {pos.x + ts, pos.y},      .uv = {uv->br.x, uv->tl.y}, .color = color};
+			v[2] = (vertex_t){.pos = {pos.x + ts, pos.y + ts}, .uv = {uv->br.x, uv->br.y}, .color = color};
+			v[3] = (vertex_t){.pos = {pos.x,      pos.y + ts}, .uv = {uv->tl.x, uv->br.y}, .color = color};
+
+			if (m) {
+				for (uint32_t i = 0; i < 4; i++) {
+					v[i].pos = vec2_transform(v[i].pos, m);
+				}
+			}
+		}
+
+		render_commit_quads(written, layer->texture);
+		draw_calls += written;
+	}
+}
+
+void render_draw_tile_layer(render_tile_layer_t *layer, vec2i_t tile_min, vec2i_t tile_max, vec2_t pos, rgba_t color) {
+	if (tile_max.x <= tile_min.x || tile_max.y <= tile_min.y) {
+		return;
+	}
+
+	float ts = layer->tile_size * screen_scale;
+	pos = vec2_mulf(pos, screen_scale);
+	mat3_t *m = transform_stack_index > 0 ? &transform_stack[transform_stack_index] : NULL;
+
+	uint32_t cols = tile_max.x - tile_min.x;
+	int map_x = ((tile_min.x % layer->size.x) + layer->size.x) % layer->size.x;
+	int map_y = ((tile_min.y % layer->size.y) + layer->size.y) % layer->size.y;
+
+	for (int y = tile_min.y; y < tile_max.y; y++, pos.y += ts) {
+		uint16_t *row = layer->data + map_y * layer->size.x;
+		if (++map_y == layer->size.y) {
+			map_y = 0;
+		}
+
+		if (layer->remap) {
+			render_tile_layer_row(layer, row, map_x, cols, pos, ts, m, color, true);
+		}
+		else {
+			render_tile_layer_row(layer, row, map_x, cols, pos, ts, m, color, false);
+		}
+	}
 }
@@ -82,10 +82,41 @@ typedef struct {
 	vertex_t vertices[4];
 } quadverts_t;
 
+// A rect of a texture in the backend's own uv space, e.g. normalized atlas 
+// coordinates. Obtained through texture_uv_rect().
+typedef struct {
+	vec2_t tl;
+	vec2_t br;
+} render_uv_rect_t;
+
 typedef struct { uint32_t index; } texture_mark_t;
 typedef struct { uint32_t index; } texture_t;
 extern texture_t RENDER_NO_TEXTURE;
 
+// A layer of tiles for render_draw_tile_layer(). Tile indices in data have a
+// bias of +1, i.e. 0 is an empty tile.
+typedef struct {
+	// The tile indices with a length of size.x * size.y
+	uint16_t *data;
+
+	// The size of the layer in tiles
+	vec2i_t size;
+
+	// The size of a tile in logical pixels
+	uint16_t tile_size;
+
+	// The texture to draw from and the uv rect for each tile (without bias).
+	// Tiles beyond tile_uvs_len are not drawn.
+	texture_t texture;
+	render_uv_rect_t *tile_uvs;
+	uint32_t tile_uvs_len;
+
+	// Optional; the tile to draw instead of each tile (without bias), e.g.
+	// the current frame of an animated tile. Must have a length of at least
+	// the highest tile index in data.
+	uint16_t *remap;
+} render_tile_layer_t;
+
 
 // Called by the platform
 void render_init(vec2i_t screen_size);
@@ -123,6 +154,29 @@ vec2_t render_snap_px(vec2_t pos);
 // color, transformed by the current transform stack
 void render_draw(vec2_t pos, vec2_t size, texture_t texture_handle, vec2_t uv_offset, vec2_t uv_size, rgba_t color);
 
+// Draw the tiles from tile_min to (excluding) tile_max of the tile layer, 
+// with the tile at tile_min drawn at the logical position pos. Tile positions
+// outside of the layer wrap around, for repeating layers. The quads are 
+// written directly into the render buffer. 
+void render_draw_tile_layer(render_tile_layer_t *layer, vec2i_t tile_min, vec2i_t tile_max, vec2_t pos, rgba_t color);
+
+// Draw quads that were built in logical coordinates relative to offset, with
+// uvs in the backend's uv space. The quads are copied into the render buffer 
+// and translated; use this for prebuilt vertex batches, e.g. cached text.
+void render_draw_quads(quadverts_t *quads, uint32_t len, texture_t texture_handle, vec2_t offset);
+
+// Same as render_draw(), but with a uv rect that is already in the backend's
+// uv space. Use this with precomputed uv rects for many draws of the same
+// parts of a texture.
+void render_draw_uv_rect(vec2_t pos, vec2_t size, texture_t texture_handle, render_uv_rect_t uv, rgba_t color);
+
+// Same as render_draw_uv_rect(), but rotated around pos + pivot by the angle
+// whose sin and cos are given. This is equivalent to render_push(), 
+// render_translate(pos + pivot), render_rotate(), drawing at -pivot and 
+// render_pop(), without copying the transform and computing the sin and cos
+// for each draw.
+void render_draw_rotated(vec2_t pos, vec2_t size, vec2_t pivot, float sin, float cos, texture_t texture_handle, render_uv_rect_t uv, rgba_t color);
+
 
 
 // The following functions must be implemented by render backend ---------------
@@ -136,10 +190,19 @@ void render_set_post_effect(render_post_effect_t post);
 void render_frame_prepare(void);
 void render_frame_end(void);
 void render_draw_quad(quadverts_t *quad, texture_t texture_handle);
+void render_draw_quad_uv_final(quadverts_t *quad, texture_t texture_handle);
+
+// Reserve space for up to len quads with uvs in the backend's space. Returns
+// the space and the number of quads that fit in reserved_len, which is at 
+// least 1. The reserved quads are drawn with render_commit_quads(); no other
+// render_* function may be called in between.
+quadverts_t *render_reserve_quads(uint32_t len, uint32_t *reserved_len);
+void render_commit_quads(uint32_t len, texture_t texture_handle);
 
 texture_mark_t textures_mark(void);
 void textures_reset(texture_mark_t mark);
 texture_t texture_create(vec2i_t size, rgba_t *pixels);
 void texture_replace_pixels(texture_t texture_handle, vec2i_t size, rgba_t *pixels);
+render_uv_rect_t texture_uv_rect(texture_t texture_handle, vec2_t uv_offset, vec2_t uv_size);
 
 #endif
@@ -573,6 +573,26 @@ void render_draw_quad(quadverts_t *quad, texture_t texture_handle) {
 	quad_buffer_len++;
 }
 
+void render_draw_quad_uv_final(quadverts_t *quad, texture_t texture_handle) {
+	if (quad_buffer_len >= RENDER_BUFFER_CAPACITY) {
+		render_flush();
+	}
+	quad_buffer[quad_buffer_len++] = *quad;
+}
+
+quadverts_t *render_reserve_quads(uint32_t len, uint32_t *reserved_len) {
+	if (quad_buffer_len + len > RENDER_BUFFER_CAPACITY && quad_buffer_len > 0) {
+		render_flush();
+	}
+	*reserved_len = min(len, RENDER_BUFFER_CAPACITY - quad_buffer_len);
+	return &quad_buffer[quad_buffer_len];
+}
+
+// All textures are in the atlas, so the quads are already in place
+void render_commit_quads(uint32_t len, texture_t texture_handle) {
+	quad_buffer_len += len;
+}
+
 
 
 // -----------------------------------------------------------------------------
@@ -717,6 +737,22 @@ void texture_replace_pixels(texture_t texture_handle, vec2i_t size, rgba_t *pixe
 
 	glBindTexture(GL_TEXTURE_2D, atlas_texture);
 	glTexSubImage2D(GL_TEXTURE_2D, 0, t->offset.x, t->offset.y, size.x, size.y, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	mipmap_is_dirty = RENDER_USE_MIPMAPS;
+}
+
+render_uv_rect_t texture_uv_rect(texture_t texture_handle, vec2_t uv_offset, vec2_t uv_size) {
+	error_if(texture_handle.index >= textures_len, "Invalid texture %d", texture_handle.index);
+	atlas_pos_t *t = &textures[texture_handle.index];
+	return (render_uv_rect_t){
+		.tl = {
+			(uv_offset.x + t->offset.x) * (1.0 / RENDER_ATLAS_SIZE_PX),
+			(uv_offset.y + t->offset.y) * (1.0 / RENDER_ATLAS_SIZE_PX)
+		},
+		.br = {
+			(uv_offset.x + uv_size.x + t->offset.x) * (1.0 / RENDER_ATLAS_SIZE_PX),
+			(uv_offset.y + uv_size.y + t->offset.y) * (1.0 / RENDER_ATLAS_SIZE_PX)
+		}
+	};
 }
 
 // void textures_dump(const char *path) {
@@ -106,6 +106,25 @@ void render_draw_quad(quadverts_t *quad, texture_t texture_handle) {
 	}
 }
 
+// The uv space of this backend is in texture pixels already
+void render_draw_quad_uv_final(quadverts_t *quad, texture_t texture_handle) {
+	render_draw_quad(quad, texture_handle);
+}
+
+// There's no buffer to write into; quads are drawn from this one on commit
+static quadverts_t reserved_quads[256];
+
+quadverts_t *render_reserve_quads(uint32_t len, uint32_t *reserved_len) {
+	*reserved_len = min(len, len(reserved_quads));
+	return reserved_quads;
+}
+
+void render_commit_quads(uint32_t len, texture_t texture_handle) {
+	for (uint32_t i = 0; i < len; i++) {
+		render_draw_quad(&reserved_quads[i], texture_handle);
+	}
+}
+
 texture_mark_t textures_mark(void) {
 	return (texture_mark_t){.index = textures_len};
 }
@@ -119,7 +138,7 @@ texture_t texture_create(vec2i_t size, rgba_t *pixels) {
 	error_if(textures_len >= RENDER_TEXTURES_MAX, "RENDER_TEXTURES_MAX reached");
 
 	textures[textures_len].size = size;
-	textures[textures_len].pixels = bump_alloc(sizeof(rgba_t) * size.x * size.y);
+	textures[textures_len].pixels = bump_alloc_uninit(sizeof(rgba_t) * size.x * size.y);
 	memcpy(textures[textures_len].pixels, pixels, sizeof(rgba_t) * size.x * size.y);
 
 	texture_t texture_handle = {.index = textures_len};
@@ -142,3 +161,7 @@ void texture_replace_pixels(texture_t texture_handle, vec2i_t size, rgba_t *pixe
 		}
 	}
 }
+
+render_uv_rect_t texture_uv_rect(texture_t texture_handle, vec2_t uv_offset, vec2_t uv_size) {
+	return (render_uv_rect_t){.tl = uv_offset, .br = vec2_add(uv_offset, uv_size)};
+}
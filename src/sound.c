@@ -3,6 +3,7 @@
 #include "engine.h"
 #include "alloc.h"
 #include "platform.h"
+#include "loader.h"
 
 #define QOA_IMPLEMENTATION
 #define QOA_NO_STDIO
@@ -50,18 +51,27 @@ typedef struct {
 // sound system ----------------------------------------------------------------
 
 static float global_volume = 1;
+static uint32_t out_samplerate;
 static float inv_out_samplerate;
+static uint64_t mixed_voice_frames = 0;
 
 static sound_source_t sources[SOUND_MAX_SOURCES];
 static uint32_t sources_len = 0;
 static char *source_paths[SOUND_MAX_SOURCES] = {};
 
+// The path index is an open addressing hash table with source index + 1 in 
+// each slot (0 = empty). It's kept at most half full.
+#define SOUND_PATH_INDEX_LEN (SOUND_MAX_SOURCES * 2)
+static uint64_t source_path_hashes[SOUND_MAX_SOURCES] = {};
+static uint32_t source_path_index[SOUND_PATH_INDEX_LEN] = {};
+
 static sound_node_t sound_nodes[SOUND_MAX_NODES];
 static uint32_t nodes_len = 0;
 static uint16_t sound_unique_id = 0;
 
 
 void sound_init(int samplerate) {
+	out_samplerate = samplerate;
 	inv_out_samplerate = 1.0 / samplerate;
 }
 
@@ -72,6 +82,20 @@ void sound_cleanup(void) {
 	}
 }
 
+// Return the slot in the path index for path; either the one holding the 
+// source with this path or the empty one where it should be inserted.
+static uint32_t sound_path_slot(char *path, uint64_t hash) {
+	uint32_t slot = hash % SOUND_PATH_INDEX_LEN;
+	while (source_path_index[slot]) {
+		uint32_t index = source_path_index[slot] - 1;
+		if (source_path_hashes[index] == hash && str_equals(path, source_paths[index])) {
+			break;
+		}
+		slot = (slot + 1) % SOUND_PATH_INDEX_LEN;
+	}
+	return slot;
+}
+
 sound_mark_t sound_mark(void) {
 	return (sound_mark_t){.index = sources_len};
 }
@@ -88,6 +112,13 @@ void sound_reset(sound_mark_t mark) {
 		}
 	}
 	sources_len = mark.index;
+
+	// Rebuild the path index from the remaining sources
+	memset(source_path_index, 0, sizeof(source_path_index));
+	for (uint32_t i = 0; i < sources_len; i++) {
+		uint32_t slot = sound_path_slot(source_paths[i], source_path_hashes[i]);
+		source_path_index[slot] = i + 1;
+	}
 }
 
 void sound_halt(void) {
@@ -149,7 +180,8 @@ void sound_mix_stereo(float *dest_samples, uint32_t dest_len) {
 
 			int c = source->channels == 2 ? 1 : 0;
 
-			for (uint32_t di = 0; di < dest_len; di += 2) {
+			uint32_t di = 0;
+			for (; di < dest_len; di += 2) {
 				uint32_t source_index = (uint32_t)node->sample_pos;
 
 				// If this is a compressed source we may have to decode a 
@@ -185,10 +217,12 @@ void sound_mix_stereo(float *dest_samples, uint32_t dest_len) {
 					}
 					else {
 						node->is_playing = false;
+						di += 2;
 						break;
 					}
 				}
 			}
+			mixed_voice_frames += di >> 1;
 		}
 	}
 }
@@ -197,18 +231,35 @@ void sound_mix_stereo(float *dest_samples, uint32_t dest_len) {
 // sound_source ------------------------------------------------------------------
 
 sound_source_t *sound_source(char *path) {
-	for (uint32_t i = 0; i < sources_len; i++) {
-		if (str_equals(path, source_paths[i])) {
-			return &sources[i];
-		}
+	uint64_t hash = str_hash(path);
+	uint32_t slot = sound_path_slot(path, hash);
+	if (source_path_index[slot]) {
+		return &sources[source_path_index[slot] - 1];
 	}
 
 	error_if(sources_len >= SOUND_MAX_SOURCES, "Max sound sources (%d) reached", SOUND_MAX_SOURCES);
 	error_if(engine_is_running(), "Cant load sound source during gameplay");
+	alloc_tag_push(ALLOC_TAG_SOUNDS);
 
+	// Use the file and decoded samples from the loader, if this sound was 
+	// queued
 	uint32_t file_size;
-	uint8_t *data = platform_load_asset(path, &file_size);
-	error_if(data == NULL, "Failed to load sound %s", path);
+	int16_t *preloaded_samples = NULL;
+	uint8_t *data = loader_take_sound(path, &file_size, &preloaded_samples);
+	bool preloaded = (data != NULL);
+
+	// Prefer the mapped archive, so that long sources can reference it 
+	// directly
+	uint8_t *mapped_data = (uint8_t *)platform_map_asset(path, &file_size);
+	bool mapped = (mapped_data != NULL);
+	if (mapped) {
+		data = mapped_data;
+	}
+	else if (!preloaded) {
+		data = platform_load_asset(path, &file_size);
+		error_if(data == NULL, "Failed to load sound %s", path);
+	}
+	bool is_temp = !preloaded && !mapped;
 
 	qoa_desc desc;
 	uint32_t read_pos = qoa_decode_header(data, file_size, &desc);
@@ -225,22 +276,29 @@ sound_source_t *sound_source(char *path) {
 	// Is this source short enough to completely uncompress it on load?
 	if (total_samples <= SOUND_MAX_UNCOMPRESSED_SAMPLES) {
 		source->type = SOUND_TYPE_PCM;
-		source->pcm_samples = bump_alloc(total_samples * sizeof(int16_t));
+		source->pcm_samples = bump_alloc_uninit(total_samples * sizeof(int16_t));
 
-		uint32_t sample_index = 0;
-		uint32_t frame_len;
-		uint32_t frame_size;
-
-		do {
-			int16_t *sample_ptr = source->pcm_samples + sample_index * desc.channels;
-			frame_size = qoa_decode_frame(data + read_pos, file_size - read_pos, &desc, sample_ptr, &frame_len);
-			error_if(frame_size == 0, "QOA decode error for file %s", path);
-
-			read_pos += frame_size;
-			sample_index += frame_len;
-		} while (frame_size && sample_index < desc.samples);
+		if (preloaded_samples) {
+			memcpy(source->pcm_samples, preloaded_samples, total_samples * sizeof(int16_t));
+		}
+		else {
+			uint32_t sample_index = 0;
+			uint32_t frame_len;
+			uint32_t frame_size;
+
+			do {
+				int16_t *sample_ptr = source->pcm_samples + sample_index * desc.channels;
+				frame_size = qoa_decode_frame(data + read_pos, file_size - read_pos, &desc, sample_ptr, &frame_len);
+				error_if(frame_size == 0, "QOA decode error for file %s", path);
+
+				read_pos += frame_size;
+				sample_index += frame_len;
+			} while (frame_size && sample_index < desc.samples);
+		}
 
-		temp_free(data);
+		if (is_temp) {
+			temp_free(data);
+		}
 	}
 
 	// Longer sources will be decompressed on demand; we just decode the first
@@ -248,8 +306,18 @@ sound_source_t *sound_source(char *path) {
 	else {
 		uint32_t qoa_data_size = file_size - read_pos;
 
-		// Transfer data to bump mem
-		uint8_t *bump_data = bump_from_temp(data, read_pos, qoa_data_size);
+		// Reference the archive or transfer data to bump mem
+		uint8_t *bump_data;
+		if (mapped) {
+			bump_data = data + read_pos;
+		}
+		else if (preloaded) {
+			bump_data = bump_alloc_uninit(qoa_data_size);
+			memcpy(bump_data, data + read_pos, qoa_data_size);
+		}
+		else {
+			bump_data = bump_from_temp(data, read_pos, qoa_data_size);
+		}
 
 		source->type = SOUND_TYPE_QOA;
 		source->qoa = bump_alloc(sizeof(sound_source_qoa_t));
@@ -257,7 +325,7 @@ sound_source_t *sound_source(char *path) {
 		source->qoa->data = bump_data;
 		source->qoa->data_len = qoa_data_size;
 		source->qoa->pcm_buffer_start = 0;
-		source->qoa->pcm_buffer = bump_alloc(desc.channels * QOA_FRAME_LEN * sizeof(int16_t));
+		source->qoa->pcm_buffer = bump_alloc_uninit(desc.channels * QOA_FRAME_LEN * sizeof(int16_t));
 
 		uint32_t frame_len;
 		uint32_t frame_size = qoa_decode_frame(
@@ -268,13 +336,101 @@ sound_source_t *sound_source(char *path) {
 	}
 	
 
-	source_paths[sources_len] = bump_alloc(strlen(path)+1);
+	source_paths[sources_len] = bump_alloc_uninit(strlen(path)+1);
 	strcpy(source_paths[sources_len], path);
+	source_path_hashes[sources_len] = hash;
+	source_path_index[slot] = sources_len + 1;
 
 	sources_len++;
+	alloc_tag_pop();
 	return source;
 }
 
+bool sound_source_reload(char *path) {
+	uint32_t slot = sound_path_slot(path, str_hash(path));
+	if (!source_path_index[slot]) {
+		return false;
+	}
+	sound_source_t *source = &sources[source_path_index[slot] - 1];
+
+	// Long sources may reference the read only archive
+	uint32_t file_size;
+	if (source->type == SOUND_TYPE_QOA && platform_map_asset(path, &file_size)) {
+		return false;
+	}
+
+	uint8_t *data = platform_load_asset(path, &file_size);
+	if (!data) {
+		printf("Failed to reload sound %s\n", path);
+		return false;
+	}
+
+	qoa_desc desc;
+	uint32_t read_pos = qoa_decode_header(data, file_size, &desc);
+	uint32_t total_samples = desc.samples * desc.channels;
+	bool fits = read_pos && desc.channels == source->channels && (
+		source->type == SOUND_TYPE_PCM
+			? total_samples <= source->len * source->channels
+			: file_size - read_pos <= source->qoa->data_len
+	);
+	if (!fits) {
+		printf("Failed to reload sound %s; it's invalid or grew in size\n", path);
+		temp_free(data);
+		return false;
+	}
+
+	// Decode short sounds before taking the lock, so the mixer is only held 
+	// up for the copy
+	int16_t *pcm_samples = NULL;
+	if (source->type == SOUND_TYPE_PCM) {
+		pcm_samples = temp_alloc(total_samples * sizeof(int16_t));
+		uint32_t sample_index = 0;
+		uint32_t frame_len;
+		uint32_t frame_size;
+		do {
+			int16_t *sample_ptr = pcm_samples + sample_index * desc.channels;
+			frame_size = qoa_decode_frame(data + read_pos, file_size - read_pos, &desc, sample_ptr, &frame_len);
+			read_pos += frame_size;
+			sample_index += frame_len;
+		} while (frame_size && sample_index < desc.samples);
+	}
+
+	// The mixer runs on the audio thread; stop all nodes playing this source
+	// and replace the data while it's locked out
+	platform_audio_lock();
+	for (int i = 0; i < SOUND_MAX_NODES; i++) {
+		if (sound_nodes[i].source == source) {
+			sound_nodes[i].is_playing = false;
+			sound_nodes[i].is_halted = false;
+			sound_nodes[i].sample_pos = 0;
+		}
+	}
+
+	source->len = desc.samples;
+	source->samplerate = desc.samplerate;
+
+	if (source->type == SOUND_TYPE_PCM) {
+		memcpy(source->pcm_samples, pcm_samples, total_samples * sizeof(int16_t));
+	}
+	else {
+		sound_source_qoa_t *qoa = source->qoa;
+		qoa->desc = desc;
+		qoa->data_len = file_size - read_pos;
+		memcpy(qoa->data, data + read_pos, qoa->data_len);
+
+		uint32_t frame_len;
+		qoa->pcm_buffer_start = 0;
+		qoa_decode_frame(qoa->data, qoa->data_len, &desc, qoa->pcm_buffer, &frame_len);
+	}
+	platform_audio_unlock();
+
+	if (pcm_samples) {
+		temp_free(pcm_samples);
+	}
+	temp_free(data);
+	return true;
+}
+
 float sound_source_duration(sound_source_t *source) {
 	return source->len / source->samplerate;
 }
@@ -496,3 +652,113 @@ void sound_set_pitch(sound_t sound, float pitch) {
 
 	node->pitch = pitch;
 }
+
+
+
+// offline render --------------------------------------------------------------
+
+#define SOUND_WAV_HEADER_SIZE 44
+
+static void sound_nodes_clear(void) {
+	for (int i = 0; i < SOUND_MAX_NODES; i++) {
+		sound_nodes[i].id = 0;
+		sound_nodes[i].is_playing = false;
+		sound_nodes[i].is_halted  = false;
+		sound_nodes[i].is_looping = false;
+	}
+}
+
+sound_render_stats_t sound_render(sound_render_event_t *events, uint32_t events_len, float *dest_samples, uint32_t dest_len) {
+	error_if(out_samplerate == 0, "sound_init() must be called before sound_render()");
+	sound_nodes_clear();
+
+	sound_render_stats_t stats = {.frames = dest_len / 2};
+	uint64_t voice_frames_start = mixed_voice_frames;
+	uint32_t event_index = 0;
+
+	for (uint32_t frame = 0; frame < stats.frames;) {
+		// Start all events that are due at the current frame. Looping nodes
+		// are not disposed, since that would also clear their loop flag; they
+		// are all released by sound_nodes_clear() at the end.
+		while (event_index < events_len && events[event_index].time * out_samplerate <= frame) {
+			sound_render_event_t *ev = &events[event_index++];
+			sound_t s = sound(ev->source);
+			sound_set_volume(s, ev->volume);
+			sound_set_pan(s, ev->pan);
+			sound_set_pitch(s, ev->pitch);
+			sound_set_loop(s, ev->loop);
+			sound_unpause(s);
+			if (!ev->loop) {
+				sound_dispose(s);
+			}
+		}
+
+		// Mix up to the end of this chunk or the next event, whichever comes
+		// first, so that events start sample accurate.
+		uint32_t frames = min(stats.frames - frame, SOUND_RENDER_CHUNK_FRAMES);
+		if (event_index < events_len) {
+			double frames_to_event = ceil(events[event_index].time * out_samplerate) - frame;
+			if (frames_to_event < frames) {
+				frames = frames_to_event;
+			}
+		}
+
+		double start = platform_now();
+		sound_mix_stereo(dest_samples + frame * 2, frames * 2);
+		stats.mix_time += platform_now() - start;
+		frame += frames;
+	}
+
+	sound_nodes_clear();
+
+	stats.voice_frames = mixed_voice_frames - voice_frames_start;
+	if (stats.voice_frames) {
+		stats.ns_per_voice_frame = (stats.mix_time * 1e9) / stats.voice_frames;
+	}
+	return stats;
+}
+
+static void sound_write_u16(uint8_t *bytes, uint16_t v) {
+	bytes[0] = v & 0xff;
+	bytes[1] = v >> 8;
+}
+
+static void sound_write_u32(uint8_t *bytes, uint32_t v) {
+	sound_write_u16(bytes + 0, v & 0xffff);
+	sound_write_u16(bytes + 2, v >> 16);
+}
+
+sound_render_stats_t sound_render_wav(char *path, sound_render_event_t *events, uint32_t events_len, float duration) {
+	uint32_t samples_len = (uint32_t)(duration * out_samplerate) * 2;
+	uint32_t data_size = samples_len * sizeof(int16_t);
+
+	// Render the float samples right behind the WAV header and convert them
+	// to int16_t in place. Each int16_t is written over a float that has
+	// already been read.
+	uint8_t *wav = temp_alloc(SOUND_WAV_HEADER_SIZE + samples_len * sizeof(float));
+	float *samples = (float *)(wav + SOUND_WAV_HEADER_SIZE);
+	sound_render_stats_t stats = sound_render(events, events_len, samples, samples_len);
+
+	for (uint32_t i = 0; i < samples_len; i++) {
+		int16_t v = clamp(samples[i], -1.0f, 1.0f) * 32767;
+		memcpy(wav + SOUND_WAV_HEADER_SIZE + i * sizeof(int16_t), &v, sizeof(int16_t));
+	}
+
+	memcpy(wav + 0, "RIFF", 4);
+	sound_write_u32(wav + 4, data_size + SOUND_WAV_HEADER_SIZE - 8);
+	memcpy(wav + 8, "WAVEfmt ", 8);
+	sound_write_u32(wav + 16, 16); // fmt chunk size
+	sound_write_u16(wav + 20, 1); // PCM
+	sound_write_u16(wav + 22, 2); // channels
+	sound_write_u32(wav + 24, out_samplerate);
+	sound_write_u32(wav + 28, out_samplerate * 2 * sizeof(int16_t));
+	sound_write_u16(wav + 32, 2 * sizeof(int16_t));
+	sound_write_u16(wav + 34, 16); // bits per sample
+	memcpy(wav + 36, "data", 4);
+	sound_write_u32(wav + 40, data_size);
+
+	uint32_t written = file_store(path, wav, SOUND_WAV_HEADER_SIZE + data_size);
+	temp_free(wav);
+	error_if(written == 0, "Failed to write WAV file %s", path);
+	return stats;
+}
@@ -52,6 +52,15 @@ void sound_mix_stereo(float *dest_samples, uint32_t dest_len);
 // the same path will return the same, cached sound source,
 sound_source_t *sound_source(char *path);
 
+// Decode the QOA file at path again and replace the samples of the already
+// loaded source in place. The new samples must fit into the memory of the old
+// ones, i.e. the sound can not get longer or change its number of channels.
+// All nodes playing this source are stopped. Returns false if no source with
+// this path is loaded or it could not be reloaded. This is used by the engine
+// for PLATFORM_HOT_RELOAD and may be called during gameplay, but only with 
+// PLATFORM_HOT_RELOAD enabled (see platform_audio_lock()).
+bool sound_source_reload(char *path);
+
 // Return the duration of a sound source
 float sound_source_duration(sound_source_t *source);
 
@@ -118,6 +127,52 @@ float sound_pitch(sound_t sound);
 // Set the current pitch (playback speed) of this node
 void sound_set_pitch(sound_t sound, float pitch);
 
+
+// Offline rendering -----------------------------------------------------------
+
+// The number of stereo frames mixed at a time by sound_render(). This mirrors
+// the buffer size that the platforms request for their audio callback.
+#if !defined(SOUND_RENDER_CHUNK_FRAMES)
+	#define SOUND_RENDER_CHUNK_FRAMES 1024
+#endif
+
+// A scripted event for sound_render(): play the source at the given time (in
+// seconds from the start of the render) with volume, pan, pitch and looping.
+typedef struct {
+	double time;
+	sound_source_t *source;
+	float volume;
+	float pan;
+	float pitch;
+	bool loop;
+} sound_render_event_t;
+
+// Timing info collected by sound_render()
+typedef struct {
+	// The number of stereo frames written
+	uint32_t frames;
+
+	// The sum of frames mixed by all nodes, i.e. frames * active voices
+	uint64_t voice_frames;
+
+	// The wall clock time in seconds spent in sound_mix_stereo()
+	double mix_time;
+
+	// mix_time in nanoseconds divided by voice_frames
+	double ns_per_voice_frame;
+} sound_render_stats_t;
+
+// Mix the scripted events into dest_samples (interleaved stereo with a length
+// of dest_len floats) against a simulated clock at the output samplerate given
+// to sound_init(). The events must be sorted by time. All nodes are stopped
+// before and after rendering. This must not be called while the platform's
+// audio callback is running; it's meant for headless benchmarks and tests.
+sound_render_stats_t sound_render(sound_render_event_t *events, uint32_t events_len, float *dest_samples, uint32_t dest_len);
+
+// Render duration seconds of the scripted events as with sound_render() and
+// store it as a 16 bit stereo WAV file at path.
+sound_render_stats_t sound_render_wav(char *path, sound_render_event_t *events, uint32_t events_len, float duration);
+
 // Called by the platform
 void sound_init(int samplerate);
 void sound_cleanup(void);
@@ -103,9 +103,7 @@ static inline mat3_t *mat3_scale(mat3_t *m, vec2_t r) {
 	return m;
 }
 
-static inline mat3_t *mat3_rotate(mat3_t *m, float r) {
-	float sin = sinf(r);
-	float cos = cosf(r);
+static inline mat3_t *mat3_rotate_sin_cos(mat3_t *m, float sin, float cos) {
 	float a = m->a, b = m->b;
 	float c = m->c, d = m->d;
 
@@ -116,6 +114,10 @@ static inline mat3_t *mat3_rotate(mat3_t *m, float r) {
 	return m;
 }
 
+static inline mat3_t *mat3_rotate(mat3_t *m, float r) {
+	return mat3_rotate_sin_cos(m, sinf(r), cosf(r));
+}
+
 static inline rgba_t rgba_blend(rgba_t in, rgba_t out) {
 	int in_a = 255 - out.a;
 	return rgba(
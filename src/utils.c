@@ -2,6 +2,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <math.h>
 #include <sys/stat.h>
 #include "utils.h"
 #include "alloc.h"
@@ -66,6 +67,16 @@ bool str_equals(const char *a, const char *b) {
 	return (strcmp(a, b) == 0);
 }
 
+uint64_t str_hash(const char *str) {
+	uint64_t h = 525201411107845655ull;
+	for (; *str; str++) {
+		h ^= (uint8_t)*str;
+		h *= 0x5bd1e9955bd1e995ull;
+		h ^= h >> 47;
+	}
+	return h;
+}
+
 bool str_starts_with(const char *haystack, const char *needle) {
 	return (strncmp(haystack, needle, strlen(needle)) == 0);
 }
@@ -80,13 +91,13 @@ char *str_format(const char *format, ...) {
 	int len = vsnprintf(NULL, 0, format, args) + 1;
 	va_end(args);
 	if (len <= 1) {
-		char *buf = bump_alloc(1);
+		char *buf = bump_alloc_uninit(1);
 		buf[0] = '\0';
 		return buf;
 	}
 
 	va_start(args, format);
-	char *buf = bump_alloc(len);
+	char *buf = bump_alloc_uninit(len);
 	vsnprintf(buf, len, format, args);
 	return buf;
 }
@@ -122,14 +133,283 @@ json_t *json_parse(uint8_t *data, uint32_t len) {
 	uint32_t size_req = 0;
 	uint32_t tokens_capacity = 1 + len / 2;
 
+	alloc_tag_push(ALLOC_TAG_JSON);
 	json_token_t *tokens = temp_alloc(tokens_capacity * sizeof(json_token_t));
 	int32_t tokens_len = json_tokenize((char *)data, len, tokens, tokens_capacity, &size_req);
 	if (tokens_len <= 0) {
+		alloc_tag_pop();
 		return NULL;
 	}
 
 	json_t *v = temp_alloc(size_req);
 	json_parse_tokens((char *)data, tokens, tokens_len, v);
 	temp_free(tokens);
+	alloc_tag_pop();
+	return v;
+}
+
+json_t *json_parse_bump(uint8_t *data, uint32_t len) {
+	uint32_t size_req = 0;
+	uint32_t tokens_capacity = 1 + len / 2;
+
+	alloc_tag_push(ALLOC_TAG_JSON);
+	json_token_t *tokens = temp_alloc(tokens_capacity * sizeof(json_token_t));
+	int32_t tokens_len = json_tokenize((char *)data, len, tokens, tokens_capacity, &size_req);
+	if (tokens_len <= 0) {
+		temp_free(tokens);
+		alloc_tag_pop();
+		return NULL;
+	}
+
+	json_t *v = bump_alloc_aligned_uninit(size_req, 8);
+	json_parse_tokens((char *)data, tokens, tokens_len, v);
+	temp_free(tokens);
+	alloc_tag_pop();
 	return v;
 }
+
+
+json_reader_t json_reader(uint8_t *data, uint32_t len) {
+	return (json_reader_t){.data = (const char *)data, .len = len, .pos = 0};
+}
+
+static bool json_read_string_fit(json_reader_t *r, char *dest, uint32_t dest_size);
+
+static char json_read_char(json_reader_t *r) {
+	while (
+		r->pos < r->len && 
+		(r->data[r->pos] == ' ' || r->data[r->pos] == '\t' || r->data[r->pos] == '\n' || r->data[r->pos] == '\r')
+	) {
+		r->pos++;
+	}
+	error_if(r->pos >= r->len, "Unexpected end of JSON");
+	return r->data[r->pos];
+}
+
+static void json_read_expect(json_reader_t *r, char c) {
+	error_if(json_read_char(r) != c, "Expected '%c' at %d in JSON", c, r->pos);
+	r->pos++;
+}
+
+json_type_t json_read_peek(json_reader_t *r) {
+	char c = json_read_char(r);
+	switch (c) {
+		case '{': return JSON_OBJECT;
+		case '[': return JSON_ARRAY;
+		case '"': return JSON_STRING;
+		case 't': return JSON_TRUE;
+		case 'f': return JSON_TRUE;
+		case 'n': return JSON_NULL;
+		default: return JSON_NUMBER;
+	}
+}
+
+void json_read_object_begin(json_reader_t *r) {
+	json_read_expect(r, '{');
+}
+
+void json_read_array_begin(json_reader_t *r) {
+	json_read_expect(r, '[');
+}
+
+bool json_read_object_next(json_reader_t *r, char *key, uint32_t key_size) {
+	char c = json_read_char(r);
+	if (c == '}') {
+		r->pos++;
+		return false;
+	}
+	if (c == ',') {
+		r->pos++;
+	}
+	// Keys that don't fit can't be one the caller is looking for; they are
+	// returned empty, so the caller skips their value
+	if (!json_read_string_fit(r, key, key_size)) {
+		key[0] = '\0';
+	}
+	json_read_expect(r, ':');
+	return true;
+}
+
+bool json_read_array_next(json_reader_t *r) {
+	char c = json_read_char(r);
+	if (c == ']') {
+		r->pos++;
+		return false;
+	}
+	if (c == ',') {
+		r->pos++;
+	}
+	return true;
+}
+
+double json_read_number(json_reader_t *r) {
+	json_read_char(r);
+	const char *s = r->data;
+	uint32_t start = r->pos;
+	uint32_t p = start;
+
+	double sign = 1;
+	if (p < r->len && s[p] == '-') {
+		sign = -1;
+		p++;
+	}
+
+	// Integers - the common case for map data - take the fast path
+	uint64_t integer = 0;
+	uint32_t digits_start = p;
+	while (p < r->len && s[p] >= '0' && s[p] <= '9') {
+		integer = integer * 10 + (s[p++] - '0');
+	}
+	error_if(p == digits_start, "Expected number at %d in JSON", r->pos);
+	bool is_integer = (p - digits_start <= 15) && !(
+		p < r->len && (s[p] == '.' || s[p] == 'e' || s[p] == 'E')
+	);
+	if (is_integer) {
+		r->pos = p;
+		return sign * integer;
+	}
+
+	// Everything else is converted by strtod(), so that we get the same
+	// result as json_parse() and the levelconv tool
+	while (
+		p < r->len && (
+			(s[p] >= '0' && s[p] <= '9') || 
+			s[p] == '.' || s[p] == 'e' || s[p] == 'E' || s[p] == '-' || s[p] == '+'
+		)
+	) {
+		p++;
+	}
+	char buf[64];
+	error_if(p - start >= sizeof(buf), "Number too long at %d in JSON", start);
+	memcpy(buf, s + start, p - start);
+	buf[p - start] = '\0';
+
+	r->pos = p;
+	return strtod(buf, NULL);
+}
+
+bool json_read_bool(json_reader_t *r) {
+	char c = json_read_char(r);
+	if (c == 't' && r->pos + 4 <= r->len && memcmp(r->data + r->pos, "true", 4) == 0) {
+		r->pos += 4;
+		return true;
+	}
+	if (c == 'f' && r->pos + 5 <= r->len && memcmp(r->data + r->pos, "false", 5) == 0) {
+		r->pos += 5;
+		return false;
+	}
+	die("Expected bool at %d in JSON", r->pos);
+}
+
+// Read the next string into dest. Returns false if it didn't fit into dest; 
+// the string is consumed completely either way.
+static bool json_read_string_fit(json_reader_t *r, char *dest, uint32_t dest_size) {
+	json_read_expect(r, '"');
+	const char *s = r->data;
+	uint32_t len = 0;
+	bool fits = true;
+
+	#define JSON_READ_PUT(C) do { \
+		if (len + 1 >= dest_size) { \
+			fits = false; \
+		} \
+		else { \
+			dest[len++] = (C); \
+		} \
+	} while(0)
+
+	while (r->pos < r->len && s[r->pos] != '"') {
+		char c = s[r->pos++];
+		if (c != '\\') {
+			JSON_READ_PUT(c);
+			continue;
+		}
+
+		error_if(r->pos >= r->len, "Unexpected end of JSON");
+		c = s[r->pos++];
+		switch (c) {
+			case 'b': JSON_READ_PUT('\b'); break;
+			case 'f': JSON_READ_PUT('\f'); break;
+			case 'n': JSON_READ_PUT('\n'); break;
+			case 'r': JSON_READ_PUT('\r'); break;
+			case 't': JSON_READ_PUT('\t'); break;
+			case 'u': {
+				error_if(r->pos + 4 > r->len, "Unexpected end of JSON");
+				uint32_t cp = 0;
+				for (int i = 0; i < 4; i++) {
+					char h = s[r->pos++];
+					cp = cp * 16 + (
+						h >= '0' && h <= '9' ? h - '0' :
+						h >= 'a' && h <= 'f' ? h - 'a' + 10 :
+						h >= 'A' && h <= 'F' ? h - 'A' + 10 : 0
+					);
+				}
+				if (cp < 0x80) {
+					JSON_READ_PUT(cp);
+				}
+				else if (cp < 0x800) {
+					JSON_READ_PUT(0xc0 | (cp >> 6));
+					JSON_READ_PUT(0x80 | (cp & 0x3f));
+				}
+				else {
+					JSON_READ_PUT(0xe0 | (cp >> 12));
+					JSON_READ_PUT(0x80 | ((cp >> 6) & 0x3f));
+					JSON_READ_PUT(0x80 | (cp & 0x3f));
+				}
+				break;
+			}
+			default: JSON_READ_PUT(c); break;
+		}
+	}
+	#undef JSON_READ_PUT
+
+	error_if(r->pos >= r->len, "Unterminated string in JSON");
+	r->pos++;
+	dest[len] = '\0';
+	return fits;
+}
+
+uint32_t json_read_string(json_reader_t *r, char *dest, uint32_t dest_size) {
+	uint32_t start = r->pos;
+	error_if(!json_read_string_fit(r, dest, dest_size), "JSON string at %d exceeds %d chars", start, dest_size - 1);
+	return strlen(dest);
+}
+
+uint8_t *json_read_skip(json_reader_t *r, uint32_t *span_len) {
+	json_read_char(r);
+	const char *s = r->data;
+	uint32_t start = r->pos;
+
+	int depth = 0;
+	do {
+		error_if(r->pos >= r->len, "Unexpected end of JSON");
+		char c = s[r->pos++];
+		if (c == '"') {
+			while (r->pos < r->len && s[r->pos] != '"') {
+				r->pos += (s[r->pos] == '\\') ? 2 : 1;
+			}
+			r->pos++;
+		}
+		else if (c == '{' || c == '[') {
+			depth++;
+		}
+		else if (c == '}' || c == ']') {
+			depth--;
+		}
+		else if (depth == 0) {
+			// A scalar at the top level; consume the rest of the literal
+			while (
+				r->pos < r->len && s[r->pos] != ',' && s[r->pos] != '}' && s[r->pos] != ']' &&
+				s[r->pos] != ' ' && s[r->pos] != '\t' && s[r->pos] != '\n' && s[r->pos] != '\r'
+			) {
+				r->pos++;
+			}
+		}
+	} while (depth > 0);
+
+	error_if(r->pos > r->len, "Unexpected end of JSON");
+	if (span_len) {
+		*span_len = r->pos - start;
+	}
+	return (uint8_t *)s + start;
+}
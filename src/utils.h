@@ -117,6 +117,9 @@ bool str_contains(const char *haystack, const char *needle);
 // A wrapper around sprintf that allocates in bump memory
 char *str_format(const char *format, ...);
 
+// A 64 bit hash of the string (MurmurOAAT64, same as used by QOP archives)
+uint64_t str_hash(const char *str);
+
 // Seed the random number generator to a particular state
 void rand_seed(uint64_t s);
 
@@ -149,4 +152,51 @@ uint32_t file_store(const char *path, void *bytes, int32_t len);
 // with temp_free(). Returns NULL on failure.
 json_t *json_parse(uint8_t *data, uint32_t len);
 
+// Parse the string data into bump allocated json. Only the tokens are temp
+// allocated during parsing. Returns NULL on failure.
+json_t *json_parse_bump(uint8_t *data, uint32_t len);
+
+
+// A pull reader that walks JSON text in place, without tokenizing it or
+// building a tree. Use this for large files where only some values are needed
+// or where values should be written straight into their final memory. Syntax
+// errors are fatal.
+typedef struct {
+	const char *data;
+	uint32_t len;
+	uint32_t pos;
+} json_reader_t;
+
+// Create a reader for the string data with len
+json_reader_t json_reader(uint8_t *data, uint32_t len);
+
+// The type of the next value, without consuming it. JSON_TRUE is returned for
+// both true and false.
+json_type_t json_read_peek(json_reader_t *r);
+
+// Enter the object or array that is the next value
+void json_read_object_begin(json_reader_t *r);
+void json_read_array_begin(json_reader_t *r);
+
+// Advance to the next key of the current object and copy it into key (with
+// key_size including the null terminator). Keys that don't fit are returned
+// as the empty string. The key's value must be read or skipped before calling
+// this again. Returns false at the end of the object.
+bool json_read_object_next(json_reader_t *r, char *key, uint32_t key_size);
+
+// Advance to the next element of the current array. The element must be read
+// or skipped before calling this again. Returns false at the end of the array.
+bool json_read_array_next(json_reader_t *r);
+
+// Read the next value as number, bool or string. Strings are unescaped into
+// dest (with dest_size including the null terminator); the string length is
+// returned.
+double json_read_number(json_reader_t *r);
+bool json_read_bool(json_reader_t *r);
+uint32_t json_read_string(json_reader_t *r, char *dest, uint32_t dest_size);
+
+// Skip over the next value. Returns a pointer to its text and its length in
+// span_len, so it can be parsed later.
+uint8_t *json_read_skip(json_reader_t *r, uint32_t *span_len);
+
 #endif